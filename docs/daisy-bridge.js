@@ -64,6 +64,9 @@ export class DaisyBridge {
             // Start heartbeat monitoring
             this.startHeartbeat();
 
+            // Listen for device replies
+            this.startReading();
+
             return true;
 
         } catch (err) {
@@ -110,6 +113,399 @@ export class DaisyBridge {
         }
     }
 
+    /**
+     * Read replies from the device
+     * Text lines emit a 'message' event. A line "!<tag>:size=<n>,..." announces
+     * a binary dump of n bytes, emitted as one 'dump' event once complete.
+     */
+    async startReading() {
+        if (!this.port || !this.port.readable || this.reader) {
+            return;
+        }
+
+        this.reader = this.port.readable.getReader();
+        const decoder = new TextDecoder();
+        let pending = new Uint8Array(0);
+        let dump = null;
+
+        try {
+            while (this.isConnected) {
+                const { value, done } = await this.reader.read();
+                if (done) break;
+
+                const joined = new Uint8Array(pending.length + value.length);
+                joined.set(pending);
+                joined.set(value, pending.length);
+                pending = joined;
+
+                while (pending.length > 0) {
+                    if (dump) {
+                        const take = Math.min(dump.data.length - dump.received, pending.length);
+                        dump.data.set(pending.subarray(0, take), dump.received);
+                        dump.received += take;
+                        pending = pending.subarray(take);
+                        if (dump.received === dump.data.length) {
+                            this.emitEvent('dump', { tag: dump.tag, fields: dump.fields, data: dump.data.buffer });
+                            dump = null;
+                        }
+                        continue;
+                    }
+
+                    const newline = pending.indexOf(10);
+                    if (newline < 0) break;
+
+                    const line = decoder.decode(pending.subarray(0, newline)).trim();
+                    pending = pending.subarray(newline + 1);
+                    if (line.startsWith('!')) {
+                        const fields = DaisyBridge.parseReport(line);
+                        const tag = line.slice(1, line.indexOf(':'));
+                        dump = { tag, fields, data: new Uint8Array(fields.size || 0), received: 0 };
+                        if (dump.data.length === 0) {
+                            this.emitEvent('dump', { tag, fields, data: dump.data.buffer });
+                            dump = null;
+                        }
+                    } else if (line) {
+                        this.emitEvent('message', { line });
+                    }
+                }
+            }
+        } catch (err) {
+            console.error("Read failed:", err);
+        } finally {
+            if (this.reader) {
+                this.reader.releaseLock();
+                this.reader = null;
+            }
+        }
+    }
+
+    /**
+     * Send a dump command and wait for the binary reply
+     * @param {string} command - Command name (e.g., "prof_dump")
+     * @param {string} tag - Dump tag to wait for (e.g., "prof")
+     * @param {number} timeoutMs - Give up after this long
+     * @returns {Promise<{fields: Object, data: ArrayBuffer}|null>} Null on timeout or refusal
+     */
+    async requestDump(command, tag, timeoutMs = 5000) {
+        const reply = new Promise((resolve) => {
+            const done = (result) => {
+                clearTimeout(timer);
+                window.removeEventListener('daisy-dump', onDump);
+                window.removeEventListener('daisy-message', onMessage);
+                resolve(result);
+            };
+            const onDump = (e) => {
+                if (e.detail.tag === tag) done({ fields: e.detail.fields, data: e.detail.data });
+            };
+            // A plain "<tag>:..." line means the device declined (busy/disabled)
+            const onMessage = (e) => {
+                if (e.detail.line.startsWith(`${tag}:`)) done(null);
+            };
+            const timer = setTimeout(() => done(null), timeoutMs);
+            window.addEventListener('daisy-dump', onDump);
+            window.addEventListener('daisy-message', onMessage);
+        });
+
+        if (!(await this.sendParam(command, 1))) {
+            return null;
+        }
+        return reply;
+    }
+
+    /**
+     * Send a report command and wait for its reply line
+     * @param {string} command - Command name (e.g., "boot_report")
+     * @param {string} prefix - Reply prefix to wait for (e.g., "boot")
+     * @param {number} timeoutMs - Give up after this long
+     * @param {number} value - Command value (most reports ignore it)
+     * @returns {Promise<Object|null>} Parsed key/value fields, or null on timeout
+     */
+    async request(command, prefix, timeoutMs = 1000, value = 1) {
+        const reply = new Promise((resolve) => {
+            const onMessage = (e) => {
+                if (e.detail.line.startsWith(`${prefix}:`)) {
+                    clearTimeout(timer);
+                    window.removeEventListener('daisy-message', onMessage);
+                    resolve(DaisyBridge.parseReport(e.detail.line));
+                }
+            };
+            const timer = setTimeout(() => {
+                window.removeEventListener('daisy-message', onMessage);
+                resolve(null);
+            }, timeoutMs);
+            window.addEventListener('daisy-message', onMessage);
+        });
+
+        if (!(await this.sendParam(command, value))) {
+            return null;
+        }
+        return reply;
+    }
+
+    /**
+     * Parse a "prefix:key=value,key=value" reply into an object
+     */
+    static parseReport(line) {
+        const fields = {};
+        const body = line.slice(line.indexOf(':') + 1);
+        for (const pair of body.split(',')) {
+            const [key, value] = pair.split('=');
+            if (key) {
+                fields[key] = Number(value);
+            }
+        }
+        return fields;
+    }
+
+    /**
+     * Query boot timing (microseconds since hw.Init, when the firmware's timer starts)
+     * @returns {Promise<Object|null>} { first_audio_us, delay_ready_us, usb_ready_us }
+     */
+    async getBootReport() {
+        return await this.request('boot_report', 'boot');
+    }
+
+    /**
+     * Query instability resets per stage since boot
+     * @returns {Promise<Object|null>} Counts keyed by stage (e.g. ch1_filter)
+     */
+    async getFaultReport() {
+        return await this.request('fault_report', 'faults');
+    }
+
+    /**
+     * Query the hum canceller
+     * @returns {Promise<Object|null>} { state (0 off, 1 detecting, 2 locked), mains_mhz, ch1_db, ch2_db }
+     */
+    async getHumReport() {
+        return await this.request('hum_report', 'hum');
+    }
+
+    /**
+     * Query command latency and main loop idle time (the window restarts on each query)
+     * @returns {Promise<Object|null>} { commands, avg_us, max_us, idle_pct, dropped }
+     */
+    async getLatencyReport() {
+        return await this.request('latency_report', 'latency');
+    }
+
+    /**
+     * Query the main loop scheduler statistics since boot, one entry per task
+     * @returns {Promise<Array<Object>|null>} [{ name, priority, runs, overruns, avg_us, max_us, budget_us }]
+     */
+    async getSchedulerStats() {
+        const names = ['footswitch', 'serial', 'controls', 'expression', 'usb_dump', 'onsets', 'scope',
+                       'feedback', 'clear', 'state_store', 'scene_store', 'led'];
+        const stats = [];
+        for (let i = 0; ; i++) {
+            const r = await this.request('sched_report', 'sched', 1000, i);
+            if (!r) {
+                return null;
+            }
+            if (r.task === undefined) {
+                return stats;
+            }
+            const { task, tasks, ...fields } = r;
+            stats.push({ name: names[task] || `task${task}`, ...fields });
+        }
+    }
+
+    /**
+     * Query the feedback notches in use
+     * @returns {Promise<Object|null>} { active (slot bit mask), n1_hz, n1_db, ... } for each active slot
+     */
+    async getFeedbackReport() {
+        return await this.request('feedback_report', 'feedback');
+    }
+
+    /**
+     * Query the auto-tap beat and onset counts
+     * @returns {Promise<Object|null>} { bpm_x10 (0 until a beat is found), onsets1, onsets2, dropped }
+     */
+    async getTempoReport() {
+        return await this.request('tempo_report', 'tempo');
+    }
+
+    /**
+     * Download per-stage cycle histograms (firmware built with STAGE_PROFILING=1)
+     * @returns {Promise<Object|null>} Per stage: { blocks, p50, p99, max, buckets: [{cycles, count}] }
+     */
+    async getStageProfile() {
+        const dump = await this.requestDump('prof_dump', 'prof');
+        if (!dump) {
+            return null;
+        }
+
+        const names = ['hum', 'drive', 'onset', 'filter', 'phaser', 'delay', 'grain', 'chorus', 'freeze', 'vocoder', 'xsynth', 'mix', 'rotary', 'notch', 'master', 'stft', 'callback'];
+        const { stages, buckets } = dump.fields;
+        const counts = new Uint32Array(dump.data);
+        // Lower bound in cycles of a quarter-octave bucket (see ProfBucket)
+        const lowerBound = (b) => b < 4 ? b : (4 + (b % 4)) * 2 ** (Math.floor(b / 4) - 1);
+
+        const profile = {};
+        for (let s = 0; s < stages; s++) {
+            const row = counts.subarray(s * buckets, (s + 1) * buckets);
+            const blocks = row.reduce((a, n) => a + n, 0);
+            const percentile = (q) => {
+                let seen = 0;
+                for (let b = 0; b < buckets; b++) {
+                    seen += row[b];
+                    if (seen >= q * blocks) return lowerBound(b);
+                }
+                return 0;
+            };
+            let max = 0;
+            row.forEach((n, b) => { if (n) max = lowerBound(b); });
+            profile[names[s] || `stage${s}`] = {
+                blocks,
+                p50: percentile(0.5),
+                p99: percentile(0.99),
+                max,
+                buckets: [...row].map((count, b) => ({ cycles: lowerBound(b), count })).filter(e => e.count)
+            };
+        }
+        return profile;
+    }
+
+    /**
+     * Download the firmware event trace and decode it into a timeline
+     * @param {string[]} paramNames - Parameter names used to decode TRACE_PARAM hashes
+     * @returns {Promise<Object[]|null>} Events oldest first:
+     *   { t: seconds relative to the dump (negative), type, arg, value, param? }
+     */
+    async getTrace(paramNames = []) {
+        const dump = await this.requestDump('trace_dump', 'trace');
+        if (!dump) {
+            return null;
+        }
+
+        const { events, head, now, cpu_hz } = dump.fields;
+        const view = new DataView(dump.data);
+        const types = { 1: 'param', 2: 'overrun', 3: 'stage_reset', 4: 'preset_load', 5: 'usb_connect', 6: 'usb_disconnect', 7: 'footswitch', 8: 'feedback', 9: 'onset', 10: 'bypass' };
+        const names = new Map(paramNames.map(n => [DaisyBridge.paramHash(n), n]));
+
+        // Oldest event first; head counts every event ever logged
+        const count = Math.min(head, events);
+        const first = head > events ? head % events : 0;
+        const raw = [];
+        for (let k = 0; k < count; k++) {
+            const off = ((first + k) % events) * 12;
+            raw.push({
+                cycles: view.getUint32(off, true),
+                type: view.getUint16(off + 4, true),
+                arg: view.getUint16(off + 6, true),
+                value: view.getFloat32(off + 8, true)
+            });
+        }
+
+        // Walk back from the dump time so 32-bit cycle wraps between events unwrap
+        let age = 0;
+        let prev = now;
+        const timeline = [];
+        for (let k = raw.length - 1; k >= 0; k--) {
+            const e = raw[k];
+            age += (prev - e.cycles) >>> 0;
+            prev = e.cycles;
+            const entry = { t: -age / cpu_hz, type: types[e.type] || `type${e.type}`, arg: e.arg, value: e.value };
+            if (e.type === 1) {
+                entry.param = names.get(e.arg) || `0x${e.arg.toString(16)}`;
+            }
+            timeline.unshift(entry);
+        }
+        return timeline;
+    }
+
+    /**
+     * Download the black box capture (freezes it if still recording; the
+     * firmware resumes recording once the transfer completes)
+     * @param {number} timeoutMs - 30 s of 16-bit audio is ~11.5 MB over USB
+     * @returns {Promise<Object|null>} { rate, reason, triggerTime (s from the start, or null),
+     *   inputs: [Float32Array, Float32Array], outputs: [Float32Array, Float32Array] }
+     */
+    async getBlackbox(timeoutMs = 120000) {
+        const dump = await this.requestDump('blackbox_dump', 'blackbox', timeoutMs);
+        if (!dump) {
+            return null;
+        }
+
+        const { blocks, block, channels, bits, rate, head, trigger, reason } = dump.fields;
+        const samples = bits === 16 ? new Int16Array(dump.data) : new Float32Array(dump.data);
+        const scale = bits === 16 ? 1 / 32768 : 1;
+
+        // Oldest block first; head counts every block ever written
+        const count = Math.min(head, blocks);
+        const first = head > blocks ? head % blocks : 0;
+        const planes = Array.from({ length: channels }, () => new Float32Array(count * block));
+        for (let k = 0; k < count; k++) {
+            const base = ((first + k) % blocks) * channels * block;
+            for (let c = 0; c < channels; c++) {
+                for (let i = 0; i < block; i++) {
+                    planes[c][k * block + i] = samples[base + c * block + i] * scale;
+                }
+            }
+        }
+
+        const reasons = ['none', 'manual', 'overrun', 'input_fault', 'stage_fault', 'output_fault'];
+        const triggerBlock = reason ? trigger - (head - count) : null;
+        return {
+            rate,
+            reason: reasons[reason] || `reason${reason}`,
+            triggerTime: triggerBlock === null ? null : triggerBlock * block / rate,
+            inputs: planes.slice(0, 2),
+            outputs: planes.slice(2, 4)
+        };
+    }
+
+    /**
+     * Arm the scope and wait for one triggered capture
+     * @param {Object} options - tap ('ch1_drive', 'ch1_filter', 'ch1_delay', 'ch2_drive',
+     *   'ch2_filter', 'ch2_delay', 'out_l', 'out_r'), length (64-8192 samples),
+     *   level (-1..1), edge ('rising' or 'falling')
+     * @param {number} timeoutMs - Disarms the scope if nothing triggers in time
+     * @returns {Promise<Object|null>} { tap, rate, triggerIndex, samples: Float32Array }
+     */
+    async getScope({ tap = 'out_l', length = 2048, level = 0.1, edge = 'rising' } = {},
+                   timeoutMs = 30000) {
+        const taps = ['off', 'ch1_drive', 'ch1_filter', 'ch1_delay',
+                      'ch2_drive', 'ch2_filter', 'ch2_delay', 'out_l', 'out_r'];
+        const index = taps.indexOf(tap);
+        if (index < 1) {
+            return null;
+        }
+        await this.sendParam('scope_tap', index);
+        await this.sendParam('scope_len', length);
+        await this.sendParam('scope_level', level);
+        await this.sendParam('scope_edge', edge === 'falling' ? 1 : 0);
+
+        const dump = await this.requestDump('scope_arm', 'scope', timeoutMs);
+        if (!dump) {
+            await this.sendParam('scope_arm', 0);
+            return null;
+        }
+
+        // Unroll the ring so the oldest sample comes first
+        const { len, head, trigger, rate } = dump.fields;
+        const raw = new Float32Array(dump.data);
+        const count = raw.length;
+        const first = head > len ? head % len : 0;
+        const samples = new Float32Array(count);
+        for (let i = 0; i < count; i++) {
+            samples[i] = raw[(first + i) % len];
+        }
+        return { tap: taps[dump.fields.tap], rate, triggerIndex: trigger, samples };
+    }
+
+    /**
+     * 16-bit FNV-1a of a parameter name (matches the firmware's ParamHash)
+     */
+    static paramHash(name) {
+        let h = 2166136261;
+        for (const c of name) {
+            h = Math.imul(h ^ c.charCodeAt(0), 16777619) >>> 0;
+        }
+        return (h ^ (h >>> 16)) & 0xffff;
+    }
+
     /**
      * Start heartbeat monitoring to detect disconnections
      */
@@ -189,6 +585,7 @@ export class DaisyBridge {
                     console.log("✓ Reconnected successfully");
                     this.emitEvent('reconnected', {});
                     this.startHeartbeat();
+                    this.startReading();
                 } else {
                     throw new Error("Port no longer available");
                 }
@@ -210,6 +607,15 @@ export class DaisyBridge {
      */
     async disconnect() {
         clearInterval(this.heartbeatInterval);
+        this.isConnected = false;
+
+        if (this.reader) {
+            try {
+                await this.reader.cancel();
+            } catch (err) {
+                console.error("Error closing reader:", err);
+            }
+        }
 
         if (this.writer) {
             try {
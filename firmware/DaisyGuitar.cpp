@@ -1,7 +1,11 @@
 #include "daisy_seed.h"
 #include "daisysp.h"
+#include "arm_math.h"
+#include "usbd_def.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
+#include <new>
 
 using namespace daisy;
 using namespace daisysp;
@@ -12,257 +16,4303 @@ constexpr size_t MAX_DELAY_SAMPLES = 48000;
 constexpr float CROSS_MOD_FREQ_RANGE = 5000.0f;
 constexpr float REVERB_LP_FREQ = 18000.0f;
 constexpr size_t AUDIO_BLOCK_SIZE = 48;
-constexpr uint32_t MAIN_LOOP_DELAY_MS = 1;
+constexpr size_t NUM_OUTPUTS = 2;
+constexpr size_t NUM_MIX_BUSES = 2;     // Channel chains feeding the output matrix
+constexpr uint32_t USB_ENUM_DELAY_MS = 100;
+constexpr size_t CLEAR_CHUNK_BYTES = 16384;  // Background clear per main loop pass
+constexpr size_t MAX_CLEAR_JOBS = 8;
+constexpr uint32_t RAMP_SAMPLES = 240;       // 5 ms click-free fade
+constexpr uint32_t SCENE_DIP_SAMPLES = 48;   // 1 ms output dip around a scene recall
+constexpr float RUNAWAY_LEVEL = 8.0f;        // Block mean |x| above this (+18 dBFS) is unstable
+constexpr size_t USB_DUMP_CHUNK = 512;       // Binary dump bytes per main loop pass
+constexpr size_t TRACE_EVENTS = 512;         // Trace ring size (power of two)
+constexpr size_t NUM_FOOTSWITCHES = 4;
+constexpr size_t NUM_SCENES = 4;
+constexpr uint32_t FOOTSWITCH_SCAN_HZ = 4000;  // Debounce timer rate
+constexpr uint16_t FOOTSWITCH_LOCKOUT_SCANS = 120; // 30 ms bounce lockout after an edge
+
+// --- HARDWARE DECLARATION ---
+DaisySeed hw;
+extern USBD_HandleTypeDef hUsbDeviceFS;  // libDaisy's FS device handle (connection state)
+
+// --- CYCLE COUNTER ---
+inline uint32_t Cycles() { return DWT->CYCCNT; }
+
+void EnableCycleCounter()
+{
+    // The core clock (and CYCCNT) stops in WFI unless D1 sleep-debug keeps it
+    // running. Trace timestamps span main loop sleeps, so keep it on.
+    DBGMCU->CR |= DBGMCU_CR_DBG_SLEEPD1;
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->LAR = 0xC5ACCE55;  // Unlock DWT on Cortex-M7
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+// --- STAGE PROFILING ---
+// Build with STAGE_PROFILING=1 to time each stage per audio block.
+// Disabled, PROFILE_STAGE/PROFILE_COMMIT_BLOCK expand to nothing.
+enum ProfileStage
+{
+    PROF_HUM = 0, PROF_DRIVE, PROF_ONSET, PROF_FILTER, PROF_PHASER, PROF_DELAY, PROF_GRAIN, PROF_CHORUS, PROF_FREEZE, PROF_VOCODER, PROF_XSYNTH, PROF_MIX, PROF_ROTARY, PROF_NOTCH, PROF_MASTER,
+    PROF_STFT,      // STFT steps of every instance (nested in freeze/xsynth)
+    PROF_CALLBACK,  // Whole callback
+    NUM_PROF_STAGES
+};
+
+#ifdef STAGE_PROFILING
+constexpr size_t PROF_BUCKETS = 128;  // Quarter-octave cycle buckets
+
+uint32_t prof_block_cycles[NUM_PROF_STAGES];          // Current block, summed over channels
+uint32_t prof_hist[NUM_PROF_STAGES][PROF_BUCKETS];    // Blocks per cycle bucket
+uint32_t prof_snapshot[NUM_PROF_STAGES][PROF_BUCKETS];
+volatile bool prof_reset_request = false;
+
+/**
+ * Quarter-octave bucket: exact below 4 cycles, then 4 buckets per power
+ * of two (lower bound of bucket b >= 4 is (4 + b % 4) << (b / 4 - 1))
+ */
+inline size_t ProfBucket(uint32_t cycles)
+{
+    if(cycles < 4)
+        return cycles;
+    uint32_t msb = 31 - __builtin_clz(cycles);
+    return (msb - 1) * 4 + ((cycles >> (msb - 2)) & 3);
+}
+
+// Adds the cycles spent in its scope to the stage's block total
+struct ScopedStageTimer
+{
+    explicit ScopedStageTimer(ProfileStage s) : stage(s), start(Cycles()) {}
+    ~ScopedStageTimer() { prof_block_cycles[stage] += Cycles() - start; }
+
+    ProfileStage stage;
+    uint32_t start;
+};
+
+// Bin the previous block's stage totals (runs at the start of each callback)
+inline void ProfileCommitBlock()
+{
+    if(prof_reset_request)
+    {
+        prof_reset_request = false;
+        memset(prof_hist, 0, sizeof(prof_hist));
+    }
+    for(size_t s = 0; s < NUM_PROF_STAGES; s++)
+    {
+        if(prof_block_cycles[s] == 0)
+            continue;  // Stage not run this block
+        prof_hist[s][ProfBucket(prof_block_cycles[s])]++;
+        prof_block_cycles[s] = 0;
+    }
+}
+
+#define PROFILE_STAGE(stage) ScopedStageTimer prof_timer_(stage)
+#define PROFILE_COMMIT_BLOCK() ProfileCommitBlock()
+#else
+#define PROFILE_STAGE(stage)
+#define PROFILE_COMMIT_BLOCK()
+#endif
+
+// --- EVENT TRACE ---
+// Fixed-size ring written from both the audio callback and the main loop.
+// A slot is claimed with an atomic increment (LDREX/STREX), so a writer
+// preempted mid-event never shares its slot; logging costs ~20 cycles.
+enum TraceType : uint16_t
+{
+    TRACE_PARAM = 1,         // arg = ParamHash(name), value = applied value
+    TRACE_OVERRUN,           // arg = 0 late block start, 1 callback over budget; value = cycles
+    TRACE_STAGE_RESET,       // arg = channel << 4 | ChannelStage (0xF0 input, 0xF1 output)
+    TRACE_PRESET_LOAD,       // arg = preset/scene index (0xFFFF = last state at boot)
+    TRACE_USB_CONNECT,
+    TRACE_USB_DISCONNECT,
+    TRACE_FOOTSWITCH,        // arg = footswitch index, value = assigned action
+    TRACE_FEEDBACK,          // arg = notch slot, value = notch frequency (Hz)
+    TRACE_ONSET,             // arg = channel, value = onset envelope level
+    TRACE_BYPASS,            // arg = channel << 4 | ChannelStage, value = 1 bypassed (at the dip's silent point)
+};
+
+struct TraceEvent
+{
+    uint32_t cycles;         // DWT cycle counter at log time
+    uint16_t type;
+    uint16_t arg;
+    float value;
+};
+
+TraceEvent trace_ring[TRACE_EVENTS];
+uint32_t trace_head = 0;            // Total events claimed (index = head % size)
+volatile bool trace_frozen = false; // Held while the ring is being dumped
+
+inline void Trace(TraceType type, uint16_t arg = 0, float value = 0.0f)
+{
+    if(trace_frozen)
+        return;
+    uint32_t idx = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED) & (TRACE_EVENTS - 1);
+    TraceEvent& e = trace_ring[idx];
+    e.cycles = Cycles();
+    e.type = type;
+    e.arg = arg;
+    e.value = value;
+}
+
+/**
+ * 16-bit FNV-1a of a parameter name, used to tag TRACE_PARAM events
+ * (the host tool hashes its known names to decode them)
+ */
+inline uint16_t ParamHash(const char* name)
+{
+    uint32_t h = 2166136261u;
+    while(*name)
+        h = (h ^ (uint8_t)*name++) * 16777619u;
+    return (uint16_t)(h ^ (h >> 16));
+}
+
+// Filter types
+enum FilterMode { LOWPASS = 0, BANDPASS = 1, HIGHPASS = 2 };
+
+// Modulation stage engines (share one block of memory, see ModFx)
+enum ModMode { MOD_CHORUS = 0, MOD_FLANGER = 1 };
+
+// Channel routing topologies (each has its own compiled audio callback)
+enum RoutingMode
+{
+    ROUTING_DUAL_MONO = 0,      // In 1 → Chain 1, In 2 → Chain 2
+    ROUTING_SERIES = 1,         // In 1 → Chain 1 → Chain 2
+    ROUTING_PARALLEL = 2,       // In 1 → Chain 1 and Chain 2
+    ROUTING_STEREO_LINKED = 3,  // Dual mono, both chains use channel 1 params
+    ROUTING_VOCODER = 4,        // Chain 1 (modulator) vocodes Chain 2 (carrier)
+    ROUTING_CROSS_SYNTH = 5,    // Chain 1's spectral envelope imposed on Chain 2
+    NUM_ROUTING_MODES
+};
+
+// Per-channel stages, in signal order
+enum ChannelStage { STAGE_DRIVE = 0, STAGE_FILTER, STAGE_DELAY, STAGE_CHORUS, NUM_CHANNEL_STAGES };
+
+// --- GAIN RAMPS ---
+// Runs in the audio callback at the silent point of a dip
+typedef void (*RampAction)(void* ctx, int arg);
+
+constexpr size_t RAMP_QUEUE = 4;    // Dip actions that can wait for one silent point
+
+struct RampJob
+{
+    RampAction action;
+    void* ctx;
+    int arg;
+};
+
+/**
+ * Click-free gain ramp for mutes, starts and discontinuous changes
+ *
+ * The control plane posts a request; the audio callback picks it up at the
+ * next block boundary. At rest (unity) the ramp costs one branch per block,
+ * while moving it costs one multiply per sample. A DIP fades to silence,
+ * runs every action posted meanwhile, then fades back to the rest level.
+ * A dip can be shorter than RAMP_SAMPLES; the shortest one queued sets it.
+ */
+struct GainRamp
+{
+    enum Request { NONE = 0, FADE_IN, FADE_OUT, DIP };
+
+    // Audio-side state
+    float gain = 1.0f;
+    float target = 1.0f;
+    float level = 1.0f;         // Rest gain a dip returns to (0 while faded out)
+    float step = 0.0f;
+    uint32_t remaining = 0;
+    uint32_t dip_len = RAMP_SAMPLES;  // Fade length of the current or next dip
+    bool dipping = false;
+
+    // Control-plane mailbox: the latest fade wins, dip actions queue up.
+    // Posting masks interrupts, so the main loop and the footswitch
+    // interrupt may both post.
+    volatile Request fade = NONE;
+    RampJob jobs[RAMP_QUEUE];
+    volatile uint32_t num_jobs = 0;
+
+    void Post(Request r, RampAction a = nullptr, void* ctx = nullptr, int arg = 0,
+              uint32_t length = RAMP_SAMPLES)
+    {
+        if(r != DIP)
+        {
+            fade = r;
+            return;
+        }
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        bool queued = num_jobs < RAMP_QUEUE;
+        if(queued)
+        {
+            jobs[num_jobs++] = {a, ctx, arg};
+            if(!dipping && length < dip_len)
+                dip_len = length;
+        }
+        __set_PRIMASK(primask);
+
+        // Queue full: better a click than a lost change
+        if(!queued && a)
+            a(ctx, arg);
+    }
+
+    // Audio side: jump to a gain and ramp towards to
+    void Start(float from, float to, uint32_t length = RAMP_SAMPLES)
+    {
+        gain = from;
+        target = to;
+        step = (to - from) / length;
+        remaining = length;
+    }
+
+    // Audio side: the signal is silent now; run the queued actions and
+    // fade back to the rest level
+    void SilentPoint()
+    {
+        RampJob run[RAMP_QUEUE];
+        uint32_t primask = __get_PRIMASK();
+        __disable_irq();
+        uint32_t n = num_jobs;
+        memcpy(run, jobs, n * sizeof(RampJob));
+        num_jobs = 0;
+        uint32_t length = dip_len;
+        dip_len = RAMP_SAMPLES;
+        dipping = false;
+        __set_PRIMASK(primask);
+
+        for(uint32_t i = 0; i < n; i++)
+            if(run[i].action) run[i].action(run[i].ctx, run[i].arg);
+        Start(0.0f, level, length);
+    }
+
+    void Apply(float* const* bufs, size_t num_bufs, size_t size)
+    {
+        if(fade != NONE)
+        {
+            level = (fade == FADE_IN) ? 1.0f : 0.0f;
+            fade = NONE;
+            if(!dipping)
+                Start(gain, level);  // A dip returns to the new level itself
+        }
+        if(num_jobs && !dipping)
+        {
+            dipping = true;
+            Start(gain, 0.0f, dip_len);
+        }
+
+        if(remaining == 0 && gain == 1.0f)
+            return;
+
+        // Ramping part of the block
+        size_t n = remaining < size ? remaining : size;
+        for(size_t c = 0; c < num_bufs; c++)
+        {
+            float g = gain;
+            for(size_t i = 0; i < n; i++)
+            {
+                g += step;
+                bufs[c][i] *= g;
+            }
+        }
+        remaining -= n;
+        gain = remaining == 0 ? target : gain + step * n;
+
+        // Settled part of the block
+        if(n < size && gain != 1.0f)
+        {
+            for(size_t c = 0; c < num_bufs; c++)
+            {
+                if(gain == 0.0f)
+                    memset(bufs[c] + n, 0, (size - n) * sizeof(float));
+                else
+                    for(size_t i = n; i < size; i++) bufs[c][i] *= gain;
+            }
+        }
+
+        // Silent point of a dip: apply the changes, then fade back in
+        if(dipping && remaining == 0)
+            SilentPoint();
+    }
+
+    void Apply(float* buf, size_t size) { Apply(&buf, 1, size); }
+};
+
+GainRamp output_ramp;   // Global start/mute ramp
+bool output_muted = false;
+
+// --- EFFECTS MODULES ---
+// Through-zero flanger: the swept tap moves between 1 and 2 * FLANGER_CENTER
+// samples while the dry path is delayed by FLANGER_CENTER, so the sweep
+// passes through zero delay relative to the dry signal. The dry and
+// feedback lines are kept apart so feedback never colours the dry path.
+constexpr size_t FLANGER_BUFFER = 256;             // Power of two, > 2 * FLANGER_CENTER
+constexpr size_t FLANGER_MASK = FLANGER_BUFFER - 1;
+constexpr float FLANGER_CENTER = 96.0f;            // 2 ms compensating dry delay
+
+struct Flanger
+{
+    float dry[FLANGER_BUFFER];
+    float line[FLANGER_BUFFER];    // Input + feedback
+    uint32_t write_pos;
+    float lfo_phase;               // 0..1
+
+    void Init() { memset(this, 0, sizeof(*this)); }
+};
+
+// Chorus and flanger never run together, so the flanger lives in the
+// chorus's delay memory. Switching engines re-initialises the storage.
+union ModFx
+{
+    ModFx() : chorus() {}
+    Chorus chorus;
+    Flanger flanger;
+};
+static_assert(sizeof(Flanger) <= sizeof(Chorus), "flanger must fit in the chorus memory");
+
+struct ChannelFx
+{
+    Overdrive drive;
+    Svf filter;
+    DelayLine<float, MAX_DELAY_SAMPLES> del;
+    ModFx mod;
+    ModMode mod_mode = MOD_CHORUS;    // Engine currently living in mod
+
+    volatile bool del_ready = false;  // Set once delay memory is cleared
+    bool del_active = false;          // Block-rate copy of del_ready
+    float del_wet = 0.0f;             // Wet scale, faded in when the memory becomes ready
+    volatile bool del_clear_request = false;  // Audio side asks main loop to re-clear
+
+    GainRamp ramp[NUM_CHANNEL_STAGES];  // Per-stage output ramps
+    volatile uint32_t faults[NUM_CHANNEL_STAGES] = {};  // Instability resets per stage
+};
+
+ChannelFx fx1;  // Channel 1 Effects
+ChannelFx fx2;  // Channel 2 Effects
+
+// --- HUM REMOVAL ---
+constexpr size_t MAX_HUM_HARMONICS = 8;
+constexpr uint32_t HUM_DETECT_BLOCKS = 1000;    // 1 s of input per detection attempt
+constexpr float HUM_DETECT_RATIO = 1e-3f;       // Min share of input power at the mains bin
+constexpr float HUM_DETECT_FLOOR = 1e-4f;       // Min hum amplitude (-80 dBFS)
+constexpr float HUM_ADAPT = 1.0f / 1000.0f;     // Per-block weight step (~1 s, ~0.3 Hz notches)
+constexpr float HUM_TRACK_GAIN = 0.0003f;       // Share of the measured drift corrected per block (slower than the fit)
+constexpr float HUM_TRACK_RANGE = 1.0f;         // Max drift from nominal mains (Hz)
+
+/**
+ * Adaptive mains hum canceller for both inputs
+ *
+ * Detection runs first: Goertzel filters at 50 and 60 Hz watch the summed
+ * input for a second, and the stronger one wins if it stands out from the
+ * rest of the signal. Once locked, a sine/cosine reference at each mains
+ * harmonic is fitted to each input and subtracted (an adaptive notch per
+ * harmonic). The references come from one rotating phasor, so a sample
+ * costs a few multiplies per harmonic. The fit is updated once per block
+ * from correlations summed over the block. Drift of the fitted phase at
+ * the fundamental shows how far the reference is off the real mains
+ * frequency, and the reference is pulled towards it.
+ */
+struct HumRemover
+{
+    enum State { HUM_OFF, HUM_DETECT, HUM_LOCKED };
+
+    State state = HUM_OFF;
+    uint32_t harmonics = 0;         // Harmonics currently fitted
+    float nominal_hz = 0.0f;        // Detected mains (50 or 60)
+    float f0 = 0.0f;                // Tracked fundamental
+    float rot_c = 1.0f;             // Per-sample rotation at f0
+    float rot_s = 0.0f;
+    float ph_c = 1.0f;              // Reference phasor at the fundamental
+    float ph_s = 0.0f;
+    float last_phase = 0.0f;        // Fitted fundamental phase at the last block
+
+    // Fitted hum per input and harmonic (sine and cosine parts)
+    float w_s[2][MAX_HUM_HARMONICS];
+    float w_c[2][MAX_HUM_HARMONICS];
+
+    // Detection: Goertzel state at 50 and 60 Hz, input energy
+    float gz_coef[2];
+    float gz_s1[2];
+    float gz_s2[2];
+    float energy = 0.0f;
+    uint32_t detect_blocks = 0;
+
+    void Init(float sample_rate)
+    {
+        gz_coef[0] = 2.0f * cosf(TWOPI_F * 50.0f / sample_rate);
+        gz_coef[1] = 2.0f * cosf(TWOPI_F * 60.0f / sample_rate);
+    }
+
+    void Restart()
+    {
+        state = HUM_DETECT;
+        gz_s1[0] = gz_s1[1] = gz_s2[0] = gz_s2[1] = 0.0f;
+        energy = 0.0f;
+        detect_blocks = 0;
+    }
+
+    void Lock(float hz)
+    {
+        state = HUM_LOCKED;
+        nominal_hz = hz;
+        f0 = hz;
+        ph_c = 1.0f;
+        ph_s = 0.0f;
+        last_phase = 0.0f;
+        memset(w_s, 0, sizeof(w_s));
+        memset(w_c, 0, sizeof(w_c));
+        harmonics = 0;
+    }
+
+    void Detect(float* const* bufs, size_t size)
+    {
+        for(size_t i = 0; i < size; i++)
+        {
+            float x = bufs[0][i] + bufs[1][i];
+            energy += x * x;
+            for(size_t b = 0; b < 2; b++)
+            {
+                float s0 = x + gz_coef[b] * gz_s1[b] - gz_s2[b];
+                gz_s2[b] = gz_s1[b];
+                gz_s1[b] = s0;
+            }
+        }
+        if(++detect_blocks < HUM_DETECT_BLOCKS)
+            return;
+
+        // A steady sine of amplitude A over n samples gives a Goertzel power
+        // of (A n / 2)^2 and an energy of n A^2 / 2
+        float n = (float)(detect_blocks * size);
+        float power[2];
+        for(size_t b = 0; b < 2; b++)
+            power[b] = gz_s1[b] * gz_s1[b] + gz_s2[b] * gz_s2[b] - gz_coef[b] * gz_s1[b] * gz_s2[b];
+        size_t best = power[1] > power[0];
+        float amp = 2.0f * sqrtf(power[best]) / n;
+        float ratio = 2.0f * power[best] / (n * energy + 1e-20f);
+        if(amp > HUM_DETECT_FLOOR && ratio > HUM_DETECT_RATIO)
+            Lock(best ? 60.0f : 50.0f);
+        else
+            Restart();
+    }
+
+    void Cancel(float* const* bufs, size_t size, uint32_t n)
+    {
+        // New harmonics start from an empty fit
+        for(size_t k = harmonics; k < n; k++)
+            for(size_t c = 0; c < 2; c++)
+                w_s[c][k] = w_c[c][k] = 0.0f;
+        harmonics = n;
+
+        float acc_s[2][MAX_HUM_HARMONICS] = {};
+        float acc_c[2][MAX_HUM_HARMONICS] = {};
+        float pc = ph_c, ps = ph_s;
+        for(size_t i = 0; i < size; i++)
+        {
+            float t = pc * rot_c - ps * rot_s;
+            ps = ps * rot_c + pc * rot_s;
+            pc = t;
+
+            // Harmonic k + 1 is the fundamental phasor raised to that power
+            float hc[MAX_HUM_HARMONICS], hs[MAX_HUM_HARMONICS];
+            hc[0] = pc;
+            hs[0] = ps;
+            for(size_t k = 1; k < n; k++)
+            {
+                hc[k] = hc[k - 1] * pc - hs[k - 1] * ps;
+                hs[k] = hs[k - 1] * pc + hc[k - 1] * ps;
+            }
+
+            for(size_t c = 0; c < 2; c++)
+            {
+                float est = 0.0f;
+                for(size_t k = 0; k < n; k++)
+                    est += w_s[c][k] * hs[k] + w_c[c][k] * hc[k];
+                float y = bufs[c][i] - est;
+                bufs[c][i] = y;
+                for(size_t k = 0; k < n; k++)
+                {
+                    acc_s[c][k] += y * hs[k];
+                    acc_c[c][k] += y * hc[k];
+                }
+            }
+        }
+
+        // Renormalise the phasor once per block (first-order correction)
+        float g = 1.5f - 0.5f * (pc * pc + ps * ps);
+        ph_c = pc * g;
+        ph_s = ps * g;
+
+        // Control rate: LMS step on the block's correlations (a sine's mean
+        // square is 1/2, hence the 2)
+        float step = 2.0f * HUM_ADAPT / size;
+        for(size_t c = 0; c < 2; c++)
+            for(size_t k = 0; k < n; k++)
+            {
+                w_s[c][k] += step * acc_s[c][k];
+                w_c[c][k] += step * acc_c[c][k];
+            }
+        Track(size);
+    }
+
+    // Follow mains drift using the rotation of the fitted fundamental
+    void Track(size_t size)
+    {
+        size_t c = (w_s[1][0] * w_s[1][0] + w_c[1][0] * w_c[1][0])
+                   > (w_s[0][0] * w_s[0][0] + w_c[0][0] * w_c[0][0]);
+        if(w_s[c][0] * w_s[c][0] + w_c[c][0] * w_c[c][0] > HUM_DETECT_FLOOR * HUM_DETECT_FLOOR)
+        {
+            float phase = atan2f(w_c[c][0], w_s[c][0]);
+            float d = phase - last_phase;
+            if(d > PI_F)
+                d -= TWOPI_F;
+            else if(d < -PI_F)
+                d += TWOPI_F;
+            last_phase = phase;
+            f0 += HUM_TRACK_GAIN * d * SAMPLE_RATE / (TWOPI_F * size);
+            f0 = fclamp(f0, nominal_hz - HUM_TRACK_RANGE, nominal_hz + HUM_TRACK_RANGE);
+        }
+        rot_c = cosf(TWOPI_F * f0 / SAMPLE_RATE);
+        rot_s = sinf(TWOPI_F * f0 / SAMPLE_RATE);
+    }
+
+    // Estimated hum level on one input (RMS over all fitted harmonics)
+    float Level(size_t c) const
+    {
+        float sum = 0.0f;
+        for(size_t k = 0; k < harmonics; k++)
+            sum += w_s[c][k] * w_s[c][k] + w_c[c][k] * w_c[c][k];
+        return sqrtf(0.5f * sum);
+    }
+
+    void Process(float* const* bufs, size_t size, bool enabled, uint32_t n)
+    {
+        PROFILE_STAGE(PROF_HUM);
+        if(!enabled)
+            state = HUM_OFF;
+        else if(state == HUM_OFF)
+            Restart();
+
+        if(state == HUM_DETECT)
+            Detect(bufs, size);
+        else if(state == HUM_LOCKED)
+            Cancel(bufs, size, n);
+    }
+};
+
+HumRemover hum;
+
+// --- VOCODER ---
+constexpr size_t VOCODER_BANDS = 16;            // 16-24 bands fit the callback budget
+constexpr size_t VOCODER_DECIMATE = 8;          // Envelopes update every 8 samples (6 kHz)
+constexpr float VOCODER_LOW_HZ = 120.0f;        // Lowest and highest band centres
+constexpr float VOCODER_HIGH_HZ = 7000.0f;
+constexpr float VOCODER_ATTACK_S = 0.002f;
+constexpr float VOCODER_MAKEUP = 4.0f;          // Band envelope to carrier gain
+static_assert(AUDIO_BLOCK_SIZE % VOCODER_DECIMATE == 0, "vocoder sub-blocks must tile a block");
+
+/**
+ * Channel vocoder: the level of each modulator band sets the gain of the
+ * same band of the carrier
+ *
+ * Coefficients and state are kept struct-of-arrays, so the per-sample loop
+ * runs over contiguous band arrays with no dependency between bands. The
+ * band envelopes are updated once per VOCODER_DECIMATE samples and the
+ * synthesis gains ramp linearly towards them in between.
+ */
+struct Vocoder
+{
+    // Band-pass (RBJ, 0 dB peak: b1 = 0, b2 = -b0), shared by both banks
+    float b0[VOCODER_BANDS];
+    float a1[VOCODER_BANDS];
+    float a2[VOCODER_BANDS];
+
+    // Transposed direct form II state per bank
+    float mod_z1[VOCODER_BANDS];
+    float mod_z2[VOCODER_BANDS];
+    float car_z1[VOCODER_BANDS];
+    float car_z2[VOCODER_BANDS];
+
+    float rect[VOCODER_BANDS];       // Rectified modulator, summed over a sub-block
+    float env[VOCODER_BANDS];
+    float gain[VOCODER_BANDS];       // Carrier band gain, ramping towards env
+    float gain_step[VOCODER_BANDS];
+
+    float attack_coef = 0.0f;
+    float release_coef = 0.0f;
+    float release_s = -1.0f;
+
+    void Init(float sample_rate)
+    {
+        // Log-spaced bands that cross at their -3 dB points
+        float ratio = powf(VOCODER_HIGH_HZ / VOCODER_LOW_HZ, 1.0f / (VOCODER_BANDS - 1));
+        float q = sqrtf(ratio) / (ratio - 1.0f);
+        for(size_t b = 0; b < VOCODER_BANDS; b++)
+        {
+            float w = TWOPI_F * VOCODER_LOW_HZ * powf(ratio, (float)b) / sample_rate;
+            float alpha = sinf(w) / (2.0f * q);
+            float a0 = 1.0f + alpha;
+            b0[b] = alpha / a0;
+            a1[b] = -2.0f * cosf(w) / a0;
+            a2[b] = (1.0f - alpha) / a0;
+        }
+        attack_coef = 1.0f - expf(-(float)VOCODER_DECIMATE / (VOCODER_ATTACK_S * sample_rate));
+        SetRelease(0.05f);
+        Reset();
+    }
+
+    void Reset()
+    {
+        memset(mod_z1, 0, sizeof(mod_z1));
+        memset(mod_z2, 0, sizeof(mod_z2));
+        memset(car_z1, 0, sizeof(car_z1));
+        memset(car_z2, 0, sizeof(car_z2));
+        memset(rect, 0, sizeof(rect));
+        memset(env, 0, sizeof(env));
+        memset(gain, 0, sizeof(gain));
+        memset(gain_step, 0, sizeof(gain_step));
+    }
+
+    // Block rate; only recomputed when the value changes
+    void SetRelease(float seconds)
+    {
+        if(seconds == release_s)
+            return;
+        release_s = seconds;
+        release_coef = 1.0f - expf(-(float)VOCODER_DECIMATE / (seconds * SAMPLE_RATE));
+    }
+
+    // out may alias mod
+    void Process(const float* mod, const float* car, float* out, size_t size)
+    {
+        for(size_t start = 0; start < size; start += VOCODER_DECIMATE)
+        {
+            for(size_t i = start; i < start + VOCODER_DECIMATE; i++)
+            {
+                float m = mod[i];
+                float c = car[i];
+                float y = 0.0f;
+                for(size_t b = 0; b < VOCODER_BANDS; b++)
+                {
+                    float ym = b0[b] * m + mod_z1[b];
+                    mod_z1[b] = mod_z2[b] - a1[b] * ym;
+                    mod_z2[b] = -b0[b] * m - a2[b] * ym;
+                    rect[b] += fabsf(ym);
+
+                    float yc = b0[b] * c + car_z1[b];
+                    car_z1[b] = car_z2[b] - a1[b] * yc;
+                    car_z2[b] = -b0[b] * c - a2[b] * yc;
+                    y += yc * gain[b];
+                    gain[b] += gain_step[b];
+                }
+                out[i] = y;
+            }
+
+            // Control rate: follow the sub-block level, ramp over the next one
+            for(size_t b = 0; b < VOCODER_BANDS; b++)
+            {
+                float level = rect[b] * (1.0f / VOCODER_DECIMATE);
+                rect[b] = 0.0f;
+                env[b] += (level - env[b]) * (level > env[b] ? attack_coef : release_coef);
+                gain_step[b] = (env[b] * VOCODER_MAKEUP - gain[b]) * (1.0f / VOCODER_DECIMATE);
+            }
+        }
+    }
+};
+
+Vocoder vocoder;
+
+// --- PHASER ---
+// Cascade of first-order all-pass stages swept by a control-rate LFO.
+// The LFO is evaluated once per block and the coefficient is interpolated
+// per sample into a table shared by every stage, so the cascade runs
+// stage by stage over the whole block: a tight 2-multiply loop per stage
+// with its state in a register. Estimated cost per channel and block at
+// 480 MHz (check with STAGE_PROFILING): 4 stages ~1.2k cycles, 8 ~2.2k,
+// 12 ~3.2k, i.e. 0.25-0.7% of the 480k-cycle block.
+constexpr size_t MAX_PHASER_STAGES = 12;
+constexpr float PHASER_MIN_HZ = 200.0f;      // Sweep bottom
+constexpr float PHASER_MAX_HZ = 4000.0f;     // Sweep top at full depth
+
+struct Phaser
+{
+    float state[MAX_PHASER_STAGES] = {};
+    float lfo_phase = 0.0f;     // 0..1
+    float coef = 0.0f;          // All-pass coefficient at the end of the last block
+    uint32_t stages = 4;        // Stages currently running
+};
+
+Phaser phasers[2];
+
+// --- ONSET DETECTION ---
+// A fast envelope (0.5 ms attack) jumping above a slow one (80 ms) marks a
+// pick attack: one abs, two one-pole updates and a compare per sample.
+// Onsets are stamped with the sample clock and queued for the main loop
+// (auto-tap), and reset the channel's auto-swell right at that sample.
+constexpr float ONSET_ATTACK_S = 0.0005f;
+constexpr float ONSET_RELEASE_S = 0.02f;
+constexpr float ONSET_SLOW_S = 0.08f;
+constexpr float ONSET_RATIO = 2.0f;             // Fast over slow envelope (+6 dB)
+constexpr float ONSET_FLOOR = 0.003f;           // Ignore anything quieter (-50 dBFS)
+constexpr uint32_t ONSET_HOLDOFF = (uint32_t)(0.06f * SAMPLE_RATE);  // Min gap between onsets
+constexpr size_t ONSET_QUEUE_SIZE = 32;         // Power of two
+
+struct OnsetDetector
+{
+    float fast = 0.0f;
+    float slow = 0.0f;
+    uint32_t holdoff = 0;       // Samples until the next onset may fire
+    float swell = 1.0f;         // Auto-swell ramp, 0 at the onset
+    volatile uint32_t count = 0;
+};
+
+struct OnsetEvent
+{
+    uint32_t sample;            // sample_clock at the onset
+    uint32_t channel;
+    float level;
+};
+
+OnsetDetector onsets[2];
+const float onset_attack = 1.0f - expf(-1.0f / (ONSET_ATTACK_S * SAMPLE_RATE));
+const float onset_release = 1.0f - expf(-1.0f / (ONSET_RELEASE_S * SAMPLE_RATE));
+const float onset_slow = 1.0f - expf(-1.0f / (ONSET_SLOW_S * SAMPLE_RATE));
+
+// Single producer (audio) / single consumer (main loop)
+OnsetEvent onset_queue[ONSET_QUEUE_SIZE];
+volatile uint32_t onset_head = 0;
+volatile uint32_t onset_tail = 0;
+volatile uint32_t onsets_dropped = 0;
+
+// --- GRANULAR ---
+constexpr size_t GRAIN_BUFFER_SAMPLES = 1 << 18;  // 5.4 s record buffer per channel (SDRAM)
+constexpr uint32_t GRAIN_BUFFER_MASK = GRAIN_BUFFER_SAMPLES - 1;
+constexpr size_t MAX_GRAINS = 32;                 // Voice cap per channel
+constexpr size_t GRAIN_WINDOW_SIZE = 1024;        // Hann table (+1 guard point)
+
+struct Grain
+{
+    uint32_t idx;       // Integer read position (wraps with the mask)
+    float frac;
+    float rate;         // Read increment (pitch)
+    float phase;        // Window table position
+    float phase_inc;
+};
+
+/**
+ * Granular cloud over a channel's recent history
+ *
+ * The channel is always recorded, so a cloud has material the moment it
+ * is turned up. New grains are scheduled once per block; only
+ * grains[0..num_active) are playing, so the per-sample cost is linear in
+ * the active grains and bounded by MAX_GRAINS.
+ */
+struct GranularFx
+{
+    Grain grains[MAX_GRAINS];
+    size_t num_active = 0;
+    uint32_t write_pos = 0;
+    float spawn_phase = 0.0f;       // Grains owed, accumulates density per block
+    float norm = 1.0f;              // Level correction for overlapping grains
+    uint32_t rng = 0x2545F491u;
+    volatile bool ready = false;    // Record buffer cleared
+};
+
+float DSY_SDRAM_BSS grain_buf[2][GRAIN_BUFFER_SAMPLES];
+GranularFx granular[2];
+float grain_window[GRAIN_WINDOW_SIZE + 1];
+
+void InitGrainWindow()
+{
+    for(size_t k = 0; k <= GRAIN_WINDOW_SIZE; k++)
+        grain_window[k] = 0.5f - 0.5f * cosf(TWOPI_F * k / GRAIN_WINDOW_SIZE);
+}
+
+// --- STFT ENGINE ---
+// Short-time Fourier transform on the audio path, built on the CMSIS real
+// FFT. The work of one frame is split into STFT_STEPS pieces run in
+// consecutive audio blocks, so a block pays for at most one transform and
+// never for the whole analyse-process-resynthesise chain at once.
+enum StftStep { STFT_IDLE = 0, STFT_ANALYSE, STFT_FORWARD, STFT_PROCESS, STFT_INVERSE, STFT_SYNTH };
+constexpr size_t STFT_STEPS = 5;
+
+// Spectrum in CMSIS packed order: re(0), re(N/2), re(1), im(1), re(2), ...
+typedef void (*SpectrumCallback)(float* spectrum, size_t fft_size, void* ctx);
+
+/**
+ * Second analysis input for an Stft, framed in step with the main input
+ * Its transform runs in STFT_ANALYSE, so each block still does at most one
+ * FFT; the spectrum is ready when the main spectrum callback runs.
+ */
+template <size_t N>
+struct StftSidechain
+{
+    float frame[N];
+    float spectrum[N];
+    float in_ring[2 * N];
+};
+
+/**
+ * Magnitudes of a packed spectrum (n / 2 + 1 bins)
+ */
+inline void SpectrumMagnitudes(const float* spectrum, float* mag, size_t n)
+{
+    mag[0] = fabsf(spectrum[0]);
+    mag[n / 2] = fabsf(spectrum[1]);
+    arm_cmplx_mag_f32(spectrum + 2, mag + 1, n / 2 - 1);
+}
+
+/**
+ * Windowed analysis, spectral callback and overlap-add resynthesis
+ *
+ * Hann windows on both sides with 75% (or more) overlap. A frame is
+ * captured in the block where its last input sample arrives and is added
+ * to the output ring STFT_STEPS - 1 blocks later; the fixed LATENCY keeps
+ * every output sample complete before it is read. All buffers are members,
+ * so instances are statically allocated (about 7 * N floats each). There
+ * are no member initializers: an instance can live in DSY_SDRAM_BSS, which
+ * is only usable once Init runs after hw.Init.
+ *
+ * Frames end where sample_clock = phase (mod HOP). Instances given
+ * different phases run their transforms in different audio blocks instead
+ * of stacking them all in one callback.
+ */
+template <size_t N, size_t HOP>
+struct Stft
+{
+    static_assert((N & (N - 1)) == 0 && N >= 32 && N <= 4096, "CMSIS real FFT size");
+    static_assert(N % HOP == 0 && N / HOP >= 4, "Hann analysis + synthesis needs 75% overlap");
+    static_assert(HOP >= STFT_STEPS * AUDIO_BLOCK_SIZE, "a frame must finish within one hop");
+
+    static constexpr size_t FFT_SIZE = N;
+    static constexpr size_t LATENCY = N + HOP;  // Input to output, samples
+    static constexpr uint32_t RING_MASK = 2 * N - 1;
+
+    arm_rfft_fast_instance_f32 fft;
+    float window[N];
+    float frame[N];
+    float spectrum[N];
+    float in_ring[2 * N];
+    float out_ring[2 * N];
+    float ola_gain;
+    StftSidechain<N>* side;      // Optional second input
+
+    uint32_t pos;                // Samples processed
+    uint32_t frame_end;          // Input index one past the frame in flight
+    uint32_t phase;              // Frame boundary offset on the sample clock
+    StftStep step;
+    SpectrumCallback process;
+    void* process_ctx;
+
+    void Init(SpectrumCallback cb, void* ctx, StftSidechain<N>* sidechain = nullptr,
+              uint32_t hop_phase = 0)
+    {
+        arm_rfft_fast_init_f32(&fft, N);
+        float sum_sq = 0.0f;
+        for(size_t j = 0; j < N; j++)
+        {
+            window[j] = 0.5f - 0.5f * cosf(TWOPI_F * j / N);
+            sum_sq += window[j] * window[j];
+        }
+        ola_gain = HOP / sum_sq;  // Squared windows overlap-add to unity
+        process = cb;
+        process_ctx = ctx;
+        side = sidechain;
+        phase = hop_phase;
+        Reset();
+    }
+
+    // clock is the sample_clock of the next block (HOP is a power of two,
+    // so the unsigned wrap keeps the modulo exact). frame_end starts one hop
+    // behind the first boundary, so no frame fires before its input is in.
+    void Reset(uint32_t clock = 0)
+    {
+        memset(in_ring, 0, sizeof(in_ring));
+        memset(out_ring, 0, sizeof(out_ring));
+        if(side)
+            memset(side->in_ring, 0, sizeof(side->in_ring));
+        pos = 0;
+        frame_end = (phase - clock) % HOP - HOP;
+        step = STFT_IDLE;
+    }
+
+    // One audio block; out may alias in or side_in
+    void Process(const float* in, float* out, size_t size, const float* side_in = nullptr)
+    {
+        for(size_t i = 0; i < size; i++)
+        {
+            uint32_t k = (pos + i) & RING_MASK;
+            in_ring[k] = in[i];
+            if(side)
+                side->in_ring[k] = side_in[i];
+            out[i] = out_ring[k];
+            out_ring[k] = 0.0f;
+        }
+        pos += size;
+
+        if(step == STFT_IDLE && pos - frame_end >= HOP)
+        {
+            frame_end += HOP;
+            step = STFT_ANALYSE;
+        }
+        RunStep();
+    }
+
+    void RunStep()
+    {
+        if(step == STFT_IDLE)
+            return;
+        PROFILE_STAGE(PROF_STFT);
+        switch(step)
+        {
+            case STFT_ANALYSE:
+                for(size_t j = 0; j < N; j++)
+                    frame[j] = in_ring[(frame_end - N + j) & RING_MASK] * window[j];
+                if(side)
+                {
+                    for(size_t j = 0; j < N; j++)
+                        side->frame[j] = side->in_ring[(frame_end - N + j) & RING_MASK] * window[j];
+                    arm_rfft_fast_f32(&fft, side->frame, side->spectrum, 0);
+                }
+                step = STFT_FORWARD;
+                break;
+
+            case STFT_FORWARD:
+                arm_rfft_fast_f32(&fft, frame, spectrum, 0);
+                step = STFT_PROCESS;
+                break;
+
+            case STFT_PROCESS:
+                if(process)
+                    process(spectrum, N, process_ctx);
+                step = STFT_INVERSE;
+                break;
+
+            case STFT_INVERSE:
+                arm_rfft_fast_f32(&fft, spectrum, frame, 1);
+                step = STFT_SYNTH;
+                break;
+
+            case STFT_SYNTH:
+                // Emitted LATENCY samples after the frame's input
+                for(size_t j = 0; j < N; j++)
+                    out_ring[(frame_end + HOP + j) & RING_MASK] += frame[j] * window[j] * ola_gain;
+                step = STFT_IDLE;
+                break;
+
+            default: break;
+        }
+    }
+};
+
+// --- SPECTRAL FREEZE ---
+constexpr size_t FREEZE_FFT = 1024;
+constexpr size_t FREEZE_HOP = 256;
+constexpr uint32_t FREEZE_HOP_PHASE = AUDIO_BLOCK_SIZE;  // Channel 2 frames one block after channel 1
+constexpr size_t FREEZE_BINS = FREEZE_FFT / 2 + 1;
+constexpr uint32_t FREEZE_FADE_SAMPLES = 4800;  // 100 ms crossfade
+constexpr size_t PHASE_LUT_SIZE = 256;
+constexpr float FREEZE_GAIN = 2.0f;  // sqrt(N / HOP): random-phase frames add in power, not amplitude
+
+/**
+ * Per-channel spectral freeze
+ *
+ * The STFT runs all the time, so the CPU cost per block is the same live
+ * or frozen (one STFT step per block either way). A capture keeps the
+ * magnitudes of one frame; while frozen, every frame is rebuilt from them
+ * with fresh random phases. Instances live in SDRAM and are set up by
+ * InitFreeze.
+ */
+struct SpectralFreeze
+{
+    Stft<FREEZE_FFT, FREEZE_HOP> stft;
+    float mag[FREEZE_BINS];     // Captured magnitudes
+    uint32_t rng;
+
+    volatile bool hold;         // Control plane: freeze on/off
+    bool was_hold;
+    bool capture_pending;       // Take the next analysed frame
+    bool frozen;                // Resynthesising from mag
+    uint32_t wet_from;          // STFT output position of the first frozen frame
+    float fade;                 // 0 = live, 1 = frozen
+};
+
+SpectralFreeze DSY_SDRAM_BSS freezes[2];
+float phase_lut[PHASE_LUT_SIZE][2];  // Unit vectors (cos, sin)
+
+/**
+ * Spectrum callback: capture, then resynthesise (silence until captured)
+ */
+void FreezeSpectrum(float* spectrum, size_t n, void* ctx)
+{
+    SpectralFreeze& fz = *static_cast<SpectralFreeze*>(ctx);
+    if(fz.capture_pending)
+    {
+        SpectrumMagnitudes(spectrum, fz.mag, n);
+        arm_scale_f32(fz.mag, FREEZE_GAIN, fz.mag, FREEZE_BINS);
+        fz.capture_pending = false;
+        fz.frozen = true;
+        fz.wet_from = fz.stft.frame_end + FREEZE_HOP;
+    }
+
+    if(!fz.frozen)
+    {
+        memset(spectrum, 0, n * sizeof(float));
+        return;
+    }
+
+    // Same magnitudes, new random phase every frame (no DC or Nyquist)
+    spectrum[0] = 0.0f;
+    spectrum[1] = 0.0f;
+    for(size_t k = 1; k < n / 2; k++)
+    {
+        fz.rng = fz.rng * 1664525u + 1013904223u;
+        const float* ph = phase_lut[fz.rng >> 24];
+        spectrum[2 * k] = fz.mag[k] * ph[0];
+        spectrum[2 * k + 1] = fz.mag[k] * ph[1];
+    }
+}
+
+void InitFreeze()
+{
+    for(size_t k = 0; k < PHASE_LUT_SIZE; k++)
+    {
+        phase_lut[k][0] = cosf(TWOPI_F * k / PHASE_LUT_SIZE);
+        phase_lut[k][1] = sinf(TWOPI_F * k / PHASE_LUT_SIZE);
+    }
+
+    for(size_t c = 0; c < 2; c++)
+    {
+        SpectralFreeze& fz = freezes[c];
+        fz.stft.Init(FreezeSpectrum, &fz, nullptr, c * FREEZE_HOP_PHASE);
+        memset(fz.mag, 0, sizeof(fz.mag));
+        fz.rng = 0x9E3779B9u + c;
+        fz.hold = false;
+        fz.was_hold = false;
+        fz.capture_pending = false;
+        fz.frozen = false;
+        fz.wet_from = 0;
+        fz.fade = 0.0f;
+    }
+}
+
+// --- SPECTRAL CROSS-SYNTHESIS ---
+// Frame size and hop trade latency against resolution. The hop must cover
+// STFT_STEPS blocks with 75% overlap, e.g. 1024/256 (27 ms latency,
+// 47 Hz bins) or 2048/512 (53 ms, 23 Hz bins).
+constexpr size_t XSYNTH_FFT = 1024;
+constexpr size_t XSYNTH_HOP = 256;
+// Frame boundaries on channel 1's freeze: of all phases this leaves the fewest
+// blocks with two transforms, and none with three
+constexpr uint32_t XSYNTH_HOP_PHASE = 0;
+constexpr size_t XSYNTH_BINS = XSYNTH_FFT / 2 + 1;
+constexpr size_t XSYNTH_SMOOTH_BINS = XSYNTH_FFT / 64;  // Envelope smoothing width (~750 Hz)
+constexpr float XSYNTH_FLOOR = 1e-4f;                   // Carrier envelope floor, per FFT point
+constexpr float XSYNTH_MAX_GAIN = 16.0f;                // +24 dB per bin at most
+
+/**
+ * Imposes the modulator's spectral envelope on the carrier
+ *
+ * Both envelopes are magnitude spectra smoothed across frequency. Each
+ * carrier bin is scaled by (1 - morph) + morph * env_mod / env_car, so
+ * morph = 1 swaps the carrier's envelope for the modulator's while keeping
+ * its fine structure (pitch, harmonics). Lives in SDRAM, set up by Init.
+ */
+struct CrossSynth
+{
+    Stft<XSYNTH_FFT, XSYNTH_HOP> stft;   // Carrier in, result out
+    StftSidechain<XSYNTH_FFT> side;      // Modulator
+    float mag[XSYNTH_BINS];
+    float env_mod[XSYNTH_BINS];
+    float env_car[XSYNTH_BINS];
+    float morph;                         // Block-rate copy of xsynth_morph
+};
+
+CrossSynth DSY_SDRAM_BSS xsynth;
+
+/**
+ * Centred moving average across bins (the window shrinks at the edges)
+ */
+void SmoothSpectrum(const float* mag, float* env, size_t bins, size_t half)
+{
+    float sum = 0.0f;
+    size_t lo = 0;
+    size_t hi = 0;
+    for(size_t k = 0; k < bins; k++)
+    {
+        while(hi < bins && hi <= k + half)
+            sum += mag[hi++];
+        while(lo + half < k)
+            sum -= mag[lo++];
+        env[k] = sum / (hi - lo);
+    }
+}
+
+void CrossSynthSpectrum(float* spectrum, size_t n, void* ctx)
+{
+    CrossSynth& xs = *static_cast<CrossSynth*>(ctx);
+    const size_t bins = n / 2 + 1;
+    const size_t half = XSYNTH_SMOOTH_BINS / 2;
+
+    SpectrumMagnitudes(xs.side.spectrum, xs.mag, n);
+    SmoothSpectrum(xs.mag, xs.env_mod, bins, half);
+    SpectrumMagnitudes(spectrum, xs.mag, n);
+    SmoothSpectrum(xs.mag, xs.env_car, bins, half);
+
+    const float env_floor = XSYNTH_FLOOR * n;
+    const float morph = xs.morph;
+    for(size_t k = 0; k < bins; k++)
+    {
+        float g = fminf(xs.env_mod[k] / (xs.env_car[k] + env_floor), XSYNTH_MAX_GAIN);
+        xs.mag[k] = (1.0f - morph) + morph * g;  // Reuse as the gain per bin
+    }
+
+    spectrum[0] *= xs.mag[0];
+    spectrum[1] *= xs.mag[n / 2];
+    for(size_t k = 1; k < n / 2; k++)
+    {
+        spectrum[2 * k] *= xs.mag[k];
+        spectrum[2 * k + 1] *= xs.mag[k];
+    }
+}
+
+void InitCrossSynth()
+{
+    xsynth.stft.Init(CrossSynthSpectrum, &xsynth, &xsynth.side, XSYNTH_HOP_PHASE);
+    xsynth.morph = 1.0f;
+}
+
+// --- ROTARY SPEAKER ---
+// Master stage after the mix matrix: the mono sum is split by a crossover
+// into a horn (highs) and a drum (lows) rotor. Rotor speed, angle, Doppler
+// delay and the AM gain at each mic are computed once per block and
+// interpolated across it, so a sample costs the crossover, one fractional
+// delay read per rotor and a 2x2 gain mix.
+constexpr float ROTARY_CROSSOVER_HZ = 800.0f;
+constexpr size_t ROTARY_BUFFER = 64;                // Power of two, > 2 * doppler + 2
+constexpr size_t ROTARY_MASK = ROTARY_BUFFER - 1;
+
+struct Rotor
+{
+    // Set up by InitRotary
+    float slow_hz;
+    float fast_hz;
+    float accel;        // Per-block speed smoothing (rotor inertia)
+    float doppler;      // Delay excursion (samples)
+    float am;           // Amplitude modulation depth
+
+    float speed = 0.0f;         // Current rotation rate (Hz)
+    float angle = 0.0f;         // Turns, 0..1
+    float delay = 1.0f;         // Doppler delay at the end of the last block
+    float gain[2] = {1.0f, 1.0f};  // AM gain per mic at the end of the last block
+    float buf[ROTARY_BUFFER] = {};
+};
+
+struct RotarySpeaker
+{
+    Rotor horn;
+    Rotor drum;
+    float xover_coef = 0.0f;
+    float lp[2] = {};           // Two-pole crossover state (low = lp, high = input - low)
+    uint32_t write_pos = 0;
+    bool active = false;        // Stage ran last block (buffers hold live audio)
+};
+
+RotarySpeaker rotary;
+
+void InitRotor(Rotor& r, float slow_hz, float fast_hz, float accel_s, float doppler, float am)
+{
+    r.slow_hz = slow_hz;
+    r.fast_hz = fast_hz;
+    r.accel = 1.0f - expf(-(AUDIO_BLOCK_SIZE / SAMPLE_RATE) / accel_s);
+    r.doppler = doppler;
+    r.am = am;
+    r.speed = slow_hz;
+}
+
+void InitRotary()
+{
+    // The light horn spins up in under a second, the heavy drum takes several
+    InitRotor(rotary.horn, 0.8f, 6.7f, 0.7f, 20.0f, 0.6f);   // ~15 cm radius
+    InitRotor(rotary.drum, 0.7f, 5.8f, 3.5f, 6.0f, 0.3f);
+    rotary.xover_coef = 1.0f - expf(-TWOPI_F * ROTARY_CROSSOVER_HZ / SAMPLE_RATE);
+}
+
+// --- FEEDBACK SUPPRESSION ---
+// The audio callback copies the output into a ring; the main loop runs an
+// FFT over it, looks for sustained narrow peaks (howl) and deploys narrow
+// cut filters on the output. The audio side only runs the active filters.
+constexpr size_t MAX_FEEDBACK_NOTCHES = 8;
+constexpr size_t FBD_FFT = 1024;                // 47 Hz bins
+constexpr size_t FBD_HOP = 512;                 // One analysis every 10.7 ms
+constexpr size_t FBD_RING = 4096;               // Power of two, > FBD_FFT + a main loop stall
+constexpr float FBD_MIN_DB = -30.0f;            // Peaks quieter than this are ignored (dBFS)
+constexpr float FBD_ABOVE_MEAN_DB = 15.0f;      // Peak over the mean bin level
+constexpr float FBD_NARROW_DB = 10.0f;          // Peak over the bins 2-3 away (a single sine)
+constexpr float FBD_HARMONIC_DB = 25.0f;        // Partial at 2f this close: a played note, not howl
+constexpr uint32_t FBD_PERSIST_FRAMES = 24;     // ~250 ms in the same bin
+constexpr uint32_t FBD_HOLDOFF_FRAMES = 20;     // Let a new notch settle before looking again
+constexpr float FBD_NOTCH_Q = 30.0f;
+constexpr float FBD_NOTCH_DB = -18.0f;          // First cut at a frequency
+constexpr float FBD_DEEPEN_DB = -6.0f;          // Extra cut if it howls again
+constexpr float FBD_MAX_CUT_DB = -36.0f;
+constexpr float FBD_SAME_NOTCH = 1.03f;         // Within ~1/2 semitone: same notch
+
+// Biquad (transposed direct form II, a0 = 1)
+struct NotchCoefs
+{
+    float b0, b1, b2, a1, a2;
+};
+
+// Audio side: filters in use, state per output
+struct NotchBank
+{
+    NotchCoefs coef[MAX_FEEDBACK_NOTCHES];
+    float z1[NUM_OUTPUTS][MAX_FEEDBACK_NOTCHES] = {};
+    float z2[NUM_OUTPUTS][MAX_FEEDBACK_NOTCHES] = {};
+    uint32_t active = 0;            // Slot bit mask
+};
+
+NotchBank notch_bank;
+
+// Main loop → callback handoff (picked up at a block boundary)
+NotchCoefs notch_pending[MAX_FEEDBACK_NOTCHES];
+uint32_t notch_pending_active = 0;
+uint32_t notch_pending_reset = 0;   // Slots whose state restarts (new frequency)
+volatile bool notch_update = false;
+
+// Main loop side: analysis buffers and notch bookkeeping
+struct FeedbackDetector
+{
+    float ring[FBD_RING];           // Written by the audio callback
+    float window[FBD_FFT];
+    float frame[FBD_FFT];
+    float spectrum[FBD_FFT];
+    float mag_db[FBD_FFT / 2 + 1];
+    arm_rfft_fast_instance_f32 fft;
+
+    uint32_t read_pos;              // Ring index of the next analysis hop
+    size_t candidate_bin;
+    uint32_t candidate_frames;
+    uint32_t holdoff;
+    float notch_hz[MAX_FEEDBACK_NOTCHES];
+    float notch_db[MAX_FEEDBACK_NOTCHES];
+    uint32_t next_slot;             // Replaced next when all slots are in use
+};
+
+FeedbackDetector DSY_SDRAM_BSS feedback;
+volatile uint32_t feedback_write_pos = 0;   // Ring samples written by the callback
+
+void InitFeedbackDetector()
+{
+    FeedbackDetector& fd = feedback;
+    arm_rfft_fast_init_f32(&fd.fft, FBD_FFT);
+    for(size_t j = 0; j < FBD_FFT; j++)
+        fd.window[j] = 0.5f - 0.5f * cosf(TWOPI_F * j / FBD_FFT);
+    fd.read_pos = 0;
+    fd.candidate_bin = 0;
+    fd.candidate_frames = 0;
+    fd.holdoff = 0;
+    fd.next_slot = 0;
+}
+
+// --- BLACK BOX RECORDER ---
+// The last BLACKBOX_SECONDS of both raw inputs and both outputs, kept in
+// SDRAM as a ring of audio blocks. A block is four planes (in1, in2, out1,
+// out2), each written with one copy or one CMSIS conversion. An overrun or
+// a fault triggers it: recording goes on for BLACKBOX_POST_BLOCKS so the
+// aftermath is kept, then stops until the capture has been downloaded.
+// Build with BLACKBOX_FLOAT=1 to keep 32-bit samples (twice the memory).
+#ifdef BLACKBOX_FLOAT
+typedef float BlackboxSample;
+#else
+typedef q15_t BlackboxSample;
+#endif
+constexpr size_t BLACKBOX_SECONDS = 30;
+constexpr size_t BLACKBOX_CHANNELS = 4;
+constexpr size_t BLACKBOX_BLOCKS = BLACKBOX_SECONDS * (size_t)SAMPLE_RATE / AUDIO_BLOCK_SIZE;
+constexpr uint32_t BLACKBOX_POST_BLOCKS = 500;  // Keep recording 0.5 s past a trigger
+
+enum BlackboxReason
+{
+    BLACKBOX_NONE = 0,
+    BLACKBOX_MANUAL,            // blackbox_freeze or blackbox_dump
+    BLACKBOX_OVERRUN,
+    BLACKBOX_INPUT_FAULT,       // NaN/Inf or runaway input block
+    BLACKBOX_STAGE_FAULT,       // A channel stage was reset
+    BLACKBOX_OUTPUT_FAULT,
+};
+
+struct BlackboxBlock
+{
+    BlackboxSample planes[BLACKBOX_CHANNELS][AUDIO_BLOCK_SIZE];
+};
+
+BlackboxBlock DSY_SDRAM_BSS blackbox[BLACKBOX_BLOCKS];
+
+struct BlackboxState
+{
+    uint32_t head = 0;                  // Blocks written since boot (slot = head % BLACKBOX_BLOCKS)
+    uint32_t trigger_block = 0;         // head when the trigger fired
+    uint32_t post = 0;                  // Blocks still to record after the trigger
+    volatile uint32_t reason = BLACKBOX_NONE;
+    volatile bool frozen = false;
+};
+
+BlackboxState blackbox_state;
+
+// The first trigger wins; later ones land in the same capture.
+// Called from the callback and the main loop, so the update is done with
+// interrupts masked: the callback must never see a half-written trigger.
+inline void BlackboxTrigger(BlackboxReason reason, uint32_t post = BLACKBOX_POST_BLOCKS)
+{
+    BlackboxState& bb = blackbox_state;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if(bb.reason == BLACKBOX_NONE)
+    {
+        bb.trigger_block = bb.head;
+        bb.post = post;
+        bb.reason = reason;
+    }
+    __set_PRIMASK(primask);
+}
+
+// --- SCOPE ---
+constexpr size_t SCOPE_MAX_SAMPLES = 8192;
+constexpr size_t SCOPE_MIN_SAMPLES = 64;
+
+// Tap points (channel taps are laid out ch1 then ch2)
+enum ScopeTapPoint
+{
+    SCOPE_OFF = 0,
+    SCOPE_CH1_DRIVE,
+    SCOPE_CH1_FILTER,
+    SCOPE_CH1_DELAY,
+    SCOPE_CH2_DRIVE,
+    SCOPE_CH2_FILTER,
+    SCOPE_CH2_DELAY,
+    SCOPE_OUT_L,
+    SCOPE_OUT_R,
+    NUM_SCOPE_TAPS
+};
+
+enum ScopeState
+{
+    SCOPE_IDLE = 0,
+    SCOPE_ARMED,        // Filling the pre-trigger ring, looking for the edge
+    SCOPE_TRIGGERED,    // Filling the post-trigger part
+    SCOPE_DONE,         // Capture complete, waiting for the main loop
+    SCOPE_SENDING
+};
+
+/**
+ * One-shot triggered capture of a single tap point
+ * The callback only looks at it when point matches the tap, so an idle
+ * scope costs one compare per tap. A quarter of the window is pre-trigger.
+ */
+struct Scope
+{
+    volatile uint32_t point = SCOPE_OFF;    // Tap being captured (SCOPE_OFF when idle)
+    volatile uint32_t state = SCOPE_IDLE;
+    uint32_t tap = SCOPE_OUT_L;             // Settings (tap and len latch at scope_arm)
+    uint32_t len = 2048;
+    float level = 0.1f;
+    bool falling = false;
+    uint32_t source = SCOPE_OFF;            // Tap and window of the current capture
+    uint32_t window = 2048;
+    uint32_t written = 0;                   // Samples written this capture
+    uint32_t trigger = 0;                   // written at the trigger sample
+    uint32_t stop = 0;                      // written at which the capture completes
+    float prev = 0.0f;                      // Last sample (sign-flipped for falling edges)
+};
+
+Scope scope;
+float DSY_SDRAM_BSS scope_buf[SCOPE_MAX_SAMPLES];
+
+inline void ScopeTap(uint32_t point, const float* buf, size_t size)
+{
+    if(scope.point != point)
+        return;
+
+    Scope& sc = scope;
+    if(sc.state == SCOPE_ARMED)
+    {
+        float sign = sc.falling ? -1.0f : 1.0f;
+        float level = sign * sc.level;
+        float prev = sc.prev;
+        for(size_t i = 0; i < size; i++)
+        {
+            float x = sign * buf[i];
+            if(prev < level && x >= level)
+            {
+                sc.trigger = sc.written + i;
+                sc.stop = sc.trigger + sc.window - sc.window / 4;
+                sc.state = SCOPE_TRIGGERED;
+                break;
+            }
+            prev = x;
+        }
+        sc.prev = prev;
+    }
+
+    // Stop at exactly trigger + 3/4 window, mid-block if need be, so a short
+    // window never overwrites its own trigger sample
+    if(sc.state == SCOPE_TRIGGERED && sc.stop - sc.written < size)
+        size = sc.stop - sc.written;
+
+    uint32_t pos = sc.written % sc.window;
+    size_t n = sc.window - pos < size ? sc.window - pos : size;
+    memcpy(scope_buf + pos, buf, n * sizeof(float));
+    memcpy(scope_buf, buf + n, (size - n) * sizeof(float));
+    sc.written += size;
+
+    if(sc.state == SCOPE_TRIGGERED && sc.written >= sc.stop)
+    {
+        sc.point = SCOPE_OFF;
+        sc.state = SCOPE_DONE;
+    }
+}
+
+// Shared/Master Effects (Reverb removed for compatibility)
+// ReverbSc reverb;
+
+// --- PARAMETERS ---
+struct ChannelParams
+{
+    explicit ChannelParams(float default_pan = -1.0f) : pan(default_pan) {}
+
+    float gain = 1.0f;
+    float drive = 0.0f;
+    float filter_freq = 10000.0f;
+    float filter_res = 0.1f;
+    float delay_time = 0.0f;
+    float delay_feedback = 0.0f;
+    float delay_mix = 0.0f;
+    float chorus_depth = 0.0f;
+    float chorus_rate = 0.5f;
+    float pan;                   // -1 = hard left, +1 = hard right
+    FilterMode filter_mode = LOWPASS;
+    ModMode chorus_mode = MOD_CHORUS;
+    float flanger_feedback = 0.0f;  // -0.95..0.95, the sign sets the polarity
+    uint32_t bypass = 0;         // Bit per ChannelStage
+    float freeze_mix = 1.0f;     // 1 = crossfade to the freeze, 0 = layer it over the dry signal
+    float grain_mix = 0.0f;
+    float grain_pos = 0.2f;      // How far back grains start (0..1 of the buffer)
+    float grain_size = 0.1f;     // Seconds
+    float grain_density = 10.0f; // Grains per second
+    float grain_pitch = 0.0f;    // Semitones
+    float grain_spray = 0.1f;    // Random start offset (seconds)
+    float phaser_mix = 0.0f;
+    float phaser_rate = 0.5f;    // LFO Hz
+    float phaser_depth = 0.7f;   // Sweep range (0..1 of PHASER_MIN_HZ..PHASER_MAX_HZ in octaves)
+    uint32_t phaser_stages = 4;  // 4, 8 or 12
+    float swell_time = 0.0f;     // Auto-swell fade-in after each onset (s, 0 = off)
+};
+
+ChannelParams ch1_params(-1.0f);
+ChannelParams ch2_params(1.0f);
+
+// Cross-channel modulation
+float cross_mod_amt = 0.0f;      // Amount of cross-modulation
+float cross_bleed = 0.0f;        // How much channel 1 bleeds into channel 2 and vice versa
+float stereo_width = 1.0f;       // Stereo width control
+float balance = 0.0f;            // Output L/R balance (-1..1)
+RoutingMode routing_mode = ROUTING_DUAL_MONO;
+
+// Master
+float reverb_mix = 0.0f;
+float reverb_time = 0.5f;
+float master_gain = 1.0f;
+float vocoder_release = 0.05f;   // Band envelope release (seconds)
+float xsynth_morph = 1.0f;       // Cross-synthesis amount (0 = carrier unchanged)
+uint32_t auto_tap = 0;           // Delay time follows the beat of channel 1 (1) or 2 (2) onsets
+bool feedback_detect = false;    // Automatic feedback notches on the output
+bool hum_cancel = false;         // Adaptive mains hum removal on both inputs
+uint32_t hum_harmonics = 4;      // Mains harmonics cancelled once locked
+float rotary_mix = 0.0f;         // Rotary speaker wet/dry (0 = off)
+bool rotary_fast = false;        // Rotor target speed
+float rotary_mic_angle = 120.0f; // Angle between the two mics around the cabinet (degrees)
+bool phaser_stereo = false;      // Chain 2's phaser LFO follows chain 1's, offset by phaser_spread
+float phaser_spread = 90.0f;     // Degrees
+
+// Snapshot of every saved parameter
+struct ParamState
+{
+    ChannelParams ch1;
+    ChannelParams ch2;
+    float cross_mod_amt;
+    float cross_bleed;
+    float stereo_width;
+    float balance;
+    float reverb_mix;
+    float reverb_time;
+    float master_gain;
+    float vocoder_release;
+    float xsynth_morph;
+    float phaser_spread;
+    uint32_t phaser_stereo;
+    float rotary_mix;
+    float rotary_mic_angle;
+    uint32_t rotary_fast;
+    uint32_t hum_cancel;
+    uint32_t hum_harmonics;
+    uint32_t feedback_detect;
+    uint32_t auto_tap;
+    uint32_t routing_mode;
+};
+
+volatile bool control_changed = false;  // Params changed outside ProcessSerial (save them)
+
+// Output mix matrix: out[o] = sum(mix_matrix[o][b] * bus[b])
+// Folds pan, bleed, width, balance, reverb placeholder and master gain.
+float mix_matrix[NUM_OUTPUTS][NUM_MIX_BUSES];
+volatile bool mix_matrix_dirty = true;
+
+// Per-block buffers: validated inputs and channel buses (input to the mix matrix)
+float in_buf[2][AUDIO_BLOCK_SIZE];
+float mix_bus[NUM_MIX_BUSES][AUDIO_BLOCK_SIZE];
+
+// Samples processed since audio start (onset timestamps)
+volatile uint32_t sample_clock = 0;
+
+// Block timing (overrun detection)
+uint32_t block_period_cycles = 0;   // Set at boot from the CPU clock
+uint32_t last_block_start = 0;
+volatile uint32_t overrun_count = 0;
+
+// Instability counters outside the channel chains
+volatile uint32_t input_faults = 0;
+volatile uint32_t output_faults = 0;
+
+// Background memory clear (keeps large zeroing out of the boot path)
+struct ClearJob
+{
+    uint8_t* base;
+    size_t size;
+    size_t done;
+    volatile bool* ready;
+};
+
+ClearJob clear_jobs[MAX_CLEAR_JOBS];
+size_t num_clear_jobs = 0;
+
+// Boot timing (microseconds since hw.Init starts the System timer)
+volatile uint32_t first_audio_us = 0;
+uint32_t delay_ready_us = 0;
+uint32_t usb_ready_us = 0;
+
+// Serial input: the USB receive callback assembles lines in serial_buf and
+// queues each completed one for the main loop (single producer, single
+// consumer; head is only written by the callback, tail by the main loop)
+constexpr size_t SERIAL_LINE_LEN = 128;
+constexpr size_t SERIAL_QUEUE_LINES = 8;     // Power of two
+
+struct SerialLine
+{
+    char text[SERIAL_LINE_LEN];
+    uint32_t rx_us;                 // When the line completed
+};
+
+char serial_buf[SERIAL_LINE_LEN];
+int buf_pos = 0;
+SerialLine serial_lines[SERIAL_QUEUE_LINES];
+volatile uint32_t serial_head = 0;
+volatile uint32_t serial_tail = 0;
+volatile uint32_t serial_dropped = 0;   // Lines lost to a full queue
+
+// Main loop wake-up events, raised from interrupts. The loop sleeps in WFI
+// until one arrives (SysTick and the other interrupts also wake it).
+enum MainEvent : uint32_t
+{
+    EVENT_USB_RX = 1u << 0,         // A complete command line is waiting
+    EVENT_AUDIO_BLOCK = 1u << 1,    // The audio callback finished a block
+    EVENT_FOOTSWITCH = 1u << 2,     // A footswitch bypass toggle is waiting
+};
+
+// Control input: a pass restarts from the top when one arrives
+constexpr uint32_t EVENT_CONTROL = EVENT_USB_RX | EVENT_FOOTSWITCH;
+
+uint32_t main_events = 0;
+
+inline void SignalMain(uint32_t events)
+{
+    __atomic_fetch_or(&main_events, events, __ATOMIC_RELAXED);
+}
+
+// Command latency (line received → applied) and main loop idle time, in
+// microseconds from the free-running System::GetUs timer (wall clock even
+// across WFI, whatever the core clock does while asleep)
+struct LoopStats
+{
+    uint32_t commands = 0;
+    uint32_t latency_max = 0;
+    uint64_t latency_total = 0;
+    uint32_t idle = 0;              // Time asleep in WFI
+    uint32_t since = 0;             // GetUs() at the last report
+};
+
+LoopStats loop_stats;
+
+// --- BACKGROUND SCHEDULER ---
+// Cooperative: every main loop job is a task that runs when one of its
+// events is pending, when its period has elapsed, or when it asked to go
+// on (a sliced task returns true while it has work left and gets another
+// slice on the next pass). Due tasks run in priority order. A command that
+// arrives mid-pass sends the pass back to the top, so a long analysis task
+// never keeps control input waiting behind the rest of the queue. Each run
+// is timed with the cycle counter against the task's budget.
+typedef bool (*TaskFn)();
+
+struct Task
+{
+    const char* name;
+    TaskFn run;                 // Returns true while it has more work
+    uint8_t priority;           // 0 runs first
+    uint32_t events;            // MainEvent bits that make it due
+    uint32_t period_ms;         // 0 = events and slices only
+    uint32_t budget_us;
+    bool due = false;
+    bool more = false;
+    uint32_t last_ms = 0;
+    uint32_t budget_cycles = 0;
+    uint32_t runs = 0;
+    uint32_t overruns = 0;      // Runs over budget
+    uint32_t max_cycles = 0;
+    uint64_t total_cycles = 0;
+};
+
+constexpr size_t MAX_TASKS = 16;
+Task* sched_order[MAX_TASKS];   // Tasks sorted by priority
+Task* sched_tasks = nullptr;    // Table order (sched_report index)
+size_t sched_num = 0;
+uint32_t sched_restarts = 0;    // Passes sent back to the top by a command
+
+inline uint32_t TakeEvents()
+{
+    return __atomic_exchange_n(&main_events, 0u, __ATOMIC_RELAXED);
+}
+
+void InitScheduler(Task* tasks, size_t num)
+{
+    uint32_t cycles_per_us = System::GetSysClkFreq() / 1000000;
+    uint32_t now = System::GetNow();
+    sched_tasks = tasks;
+    sched_num = num < MAX_TASKS ? num : MAX_TASKS;
+    for(size_t i = 0; i < sched_num; i++)
+    {
+        Task* t = &tasks[i];
+        t->budget_cycles = t->budget_us * cycles_per_us;
+        t->last_ms = now;
+
+        // Insertion sort, stable for equal priorities
+        size_t k = i;
+        for(; k > 0 && sched_order[k - 1]->priority > t->priority; k--)
+            sched_order[k] = sched_order[k - 1];
+        sched_order[k] = t;
+    }
+}
+
+void MarkDueTasks(uint32_t events)
+{
+    uint32_t now = System::GetNow();
+    for(size_t i = 0; i < sched_num; i++)
+    {
+        Task& t = *sched_order[i];
+        if(t.more || (t.events & events))
+            t.due = true;
+        if(t.period_ms && now - t.last_ms >= t.period_ms)
+        {
+            t.last_ms = now;
+            t.due = true;
+        }
+    }
+}
+
+/**
+ * One scheduler pass over the due tasks
+ * Returns true if a sliced task has work left (the loop should not sleep).
+ */
+bool RunScheduler(uint32_t events)
+{
+    MarkDueTasks(events);
+    for(size_t i = 0; i < sched_num;)
+    {
+        Task& t = *sched_order[i];
+        if(!t.due)
+        {
+            i++;
+            continue;
+        }
+        t.due = false;
+
+        uint32_t t0 = Cycles();
+        t.more = t.run();
+        uint32_t cycles = Cycles() - t0;
+        t.runs++;
+        t.total_cycles += cycles;
+        if(cycles > t.max_cycles)
+            t.max_cycles = cycles;
+        if(cycles > t.budget_cycles)
+            t.overruns++;
+
+        if(i > 0 && (main_events & EVENT_CONTROL))
+        {
+            MarkDueTasks(TakeEvents());
+            sched_restarts++;
+            i = 0;
+        }
+        else
+            i++;
+    }
+
+    for(size_t i = 0; i < sched_num; i++)
+        if(sched_order[i]->more)
+            return true;
+    return false;
+}
+
+/**
+ * Soft clipping function for musical saturation
+ * Renamed to avoid conflict with DaisySP's SoftClip
+ */
+inline float MySoftClip(float x)
+{
+    if (x > 1.0f) return 1.0f;
+    if (x < -1.0f) return -1.0f;
+    return x - (x * x * x) / 3.0f;
+}
+
+/**
+ * Rebuild the output mix matrix from the routing parameters
+ *
+ * Applied in order: pan -> bleed -> stereo width -> balance -> reverb/master gain.
+ * Every stage is linear, so the whole chain collapses into one 2x2 product
+ * and the audio path only pays one multiply-accumulate per bus per output.
+ */
+void ComputeMixMatrix()
+{
+    // Constant-power pan per bus (-1 = L only, +1 = R only)
+    float pan_l1 = cosf((ch1_params.pan + 1.0f) * 0.25f * PI_F);
+    float pan_r1 = sinf((ch1_params.pan + 1.0f) * 0.25f * PI_F);
+    float pan_l2 = cosf((ch2_params.pan + 1.0f) * 0.25f * PI_F);
+    float pan_r2 = sinf((ch2_params.pan + 1.0f) * 0.25f * PI_F);
+
+    // Bleed: L' = (1-b)L + bR, R' = (1-b)R + bL
+    float keep = 1.0f - cross_bleed;
+    float bl1 = keep * pan_l1 + cross_bleed * pan_r1;
+    float bl2 = keep * pan_l2 + cross_bleed * pan_r2;
+    float br1 = keep * pan_r1 + cross_bleed * pan_l1;
+    float br2 = keep * pan_r2 + cross_bleed * pan_l2;
+
+    // Mid-side width: L' = L(1+w)/2 + R(1-w)/2
+    float wp = (1.0f + stereo_width) * 0.5f;
+    float wn = (1.0f - stereo_width) * 0.5f;
+
+    // Balance attenuates the opposite side only
+    float bal_l = balance > 0.0f ? 1.0f - balance : 1.0f;
+    float bal_r = balance < 0.0f ? 1.0f + balance : 1.0f;
+
+    // Reverb placeholder is a plain gain: (1 - mix) + mix * time
+    float out_gain = (1.0f - reverb_mix + reverb_mix * reverb_time) * master_gain;
+
+    mix_matrix[0][0] = (wp * bl1 + wn * br1) * bal_l * out_gain;
+    mix_matrix[0][1] = (wp * bl2 + wn * br2) * bal_l * out_gain;
+    mix_matrix[1][0] = (wn * bl1 + wp * br1) * bal_r * out_gain;
+    mix_matrix[1][1] = (wn * bl2 + wp * br2) * bal_r * out_gain;
+}
+
+/**
+ * Construct and clear one modulation engine in the shared storage
+ */
+void InitModFx(ChannelFx& fx, ModMode mode)
+{
+    if(mode == MOD_FLANGER)
+    {
+        new(&fx.mod.flanger) Flanger();
+        fx.mod.flanger.Init();
+    }
+    else
+    {
+        new(&fx.mod.chorus) Chorus();
+        fx.mod.chorus.Init(SAMPLE_RATE);
+    }
+    fx.mod_mode = mode;
+}
+
+/**
+ * Apply block-rate channel settings (params only change between blocks)
+ */
+inline void PrepareChannel(ChannelFx& fx, const ChannelParams& p)
+{
+    fx.drive.SetDrive(p.drive);
+    fx.filter.SetRes(p.filter_res);
+    if(fx.mod_mode != p.chorus_mode)
+        InitModFx(fx, p.chorus_mode);
+    if(fx.mod_mode == MOD_CHORUS)
+    {
+        fx.mod.chorus.SetLfoDepth(p.chorus_depth);
+        fx.mod.chorus.SetLfoFreq(p.chorus_rate);
+    }
+
+    // Delay memory just became ready: fade the wet path in rather than step
+    // the dry/wet mix (the dry signal stays at unity)
+    if(fx.del_ready && !fx.del_active)
+        fx.del_wet = 0.0f;
+    fx.del_active = fx.del_ready;
+}
+
+/**
+ * Block-level stability check
+ * NaN and Inf propagate into the sum, so one compare covers non-finite
+ * samples as well as runaway levels.
+ */
+inline bool BlockUnstable(const float* buf, size_t size)
+{
+    float sum = 0.0f;
+    for(size_t i = 0; i < size; i++)
+        sum += fabsf(buf[i]);
+    return !(sum <= RUNAWAY_LEVEL * size);
+}
+
+inline bool Bypassed(const ChannelParams& p, ChannelStage stage)
+{
+    return p.bypass & (1u << stage);
+}
+
+/**
+ * Reset the internal state of a single stage
+ */
+void ResetStage(ChannelFx& fx, ChannelStage stage)
+{
+    switch(stage) {
+        case STAGE_DRIVE:  fx.drive.Init(); break;
+        case STAGE_FILTER: fx.filter.Init(SAMPLE_RATE); break;
+        case STAGE_CHORUS: InitModFx(fx, fx.mod_mode); break;
+        case STAGE_DELAY:
+            // Too large to clear here: bypass until the main loop re-clears it
+            fx.del_ready = false;
+            fx.del_active = false;
+            fx.del_clear_request = true;
+            break;
+        default: break;
+    }
+}
+
+/**
+ * Check a stage's output block; on instability reset only that stage,
+ * silence the block and fade the stage back in.
+ */
+inline void GuardStage(ChannelFx& fx, ChannelStage stage, float* buf, size_t size)
+{
+    if(!BlockUnstable(buf, size))
+        return;
+
+    memset(buf, 0, size * sizeof(float));
+    ResetStage(fx, stage);
+    fx.faults[stage] = fx.faults[stage] + 1;
+    Trace(TRACE_STAGE_RESET, (&fx == &fx2 ? 0x10 : 0x00) | stage);
+    BlackboxTrigger(BLACKBOX_STAGE_FAULT);
+    // The block is silent now: a dip in progress has reached its silent point
+    fx.ramp[stage].SilentPoint();
+}
+
+// --- CHANNEL STAGES ---
+// Each stage processes a whole block in place and ends with its stability
+// check and gain ramp (the ramp is free unless a fade is in progress).
+// A bypassed stage still runs its ramp so a pending bypass dip completes.
+
+// Input gain + overdrive
+inline void DriveStage(ChannelFx& fx, const ChannelParams& p, const float* in, float* out, size_t size)
+{
+    PROFILE_STAGE(PROF_DRIVE);
+    if(Bypassed(p, STAGE_DRIVE))
+    {
+        // Input gain still applies
+        for(size_t i = 0; i < size; i++)
+            out[i] = in[i] * p.gain;
+    }
+    else
+    {
+        for(size_t i = 0; i < size; i++)
+            out[i] = fx.drive.Process(in[i] * p.gain);
+        GuardStage(fx, STAGE_DRIVE, out, size);
+    }
+    fx.ramp[STAGE_DRIVE].Apply(out, size);
+}
+
+/**
+ * Onset detection on the channel input and auto-swell on its output
+ * Runs only when something uses the onsets (swell on, or auto-tap
+ * listening to this channel).
+ */
+inline void OnsetStage(ChannelFx& fx, const ChannelParams& p, const float* in, float* out, size_t size)
+{
+    PROFILE_STAGE(PROF_ONSET);
+    uint32_t ch = &fx == &fx2;
+    OnsetDetector& od = onsets[ch];
+    bool swell = p.swell_time > 0.0f;
+    if(!swell && auto_tap != ch + 1)
+    {
+        od.swell = 1.0f;
+        return;
+    }
+
+    float fast = od.fast, slow = od.slow, gain = od.swell;
+    uint32_t holdoff = od.holdoff;
+    float inc = swell ? 1.0f / (p.swell_time * SAMPLE_RATE) : 1.0f;
+    for(size_t i = 0; i < size; i++)
+    {
+        float x = fabsf(in[i]);
+        fast += (x > fast ? onset_attack : onset_release) * (x - fast);
+        slow += onset_slow * (fast - slow);
+        if(holdoff > 0)
+        {
+            holdoff--;
+        }
+        else if(fast > ONSET_RATIO * slow && fast > ONSET_FLOOR)
+        {
+            holdoff = ONSET_HOLDOFF;
+            gain = 0.0f;
+            od.count = od.count + 1;
+            uint32_t head = onset_head;
+            if(head - onset_tail < ONSET_QUEUE_SIZE)
+            {
+                onset_queue[head & (ONSET_QUEUE_SIZE - 1)] = {sample_clock + (uint32_t)i, ch, fast};
+                onset_head = head + 1;
+            }
+            else
+            {
+                onsets_dropped = onsets_dropped + 1;
+            }
+            Trace(TRACE_ONSET, ch, fast);
+        }
+
+        // Swell in from silence after each attack (squared for a smoother fade)
+        gain = fminf(gain + inc, 1.0f);
+        out[i] *= gain * gain;
+    }
+    od.fast = fast;
+    od.slow = slow;
+    od.holdoff = holdoff;
+    od.swell = gain;
+}
+
+// Filter with cross-modulation from the other input (mod)
+inline void FilterStage(ChannelFx& fx, const ChannelParams& p, const float* mod, float* buf, size_t size)
+{
+    PROFILE_STAGE(PROF_FILTER);
+    if(Bypassed(p, STAGE_FILTER))
+    {
+        fx.ramp[STAGE_FILTER].Apply(buf, size);
+        return;
+    }
+
+    bool cross_mod = cross_mod_amt > 0.0f;
+    if(!cross_mod)
+        fx.filter.SetFreq(p.filter_freq);
+
+    for(size_t i = 0; i < size; i++)
+    {
+        if(cross_mod) {
+            float mod_freq = p.filter_freq + (mod[i] * cross_mod_amt * CROSS_MOD_FREQ_RANGE);
+            fx.filter.SetFreq(fclamp(mod_freq, 20.0f, 20000.0f));
+        }
+        fx.filter.Process(buf[i]);
+
+        // Select filter output based on mode
+        switch(p.filter_mode) {
+            case LOWPASS:  buf[i] = fx.filter.Low();  break;
+            case BANDPASS: buf[i] = fx.filter.Band(); break;
+            case HIGHPASS: buf[i] = fx.filter.High(); break;
+        }
+    }
+    GuardStage(fx, STAGE_FILTER, buf, size);
+    fx.ramp[STAGE_FILTER].Apply(buf, size);
+}
+
+// Phaser (the LFO keeps running at zero mix so stereo phase stays locked)
+inline void PhaserStage(ChannelFx& fx, const ChannelParams& p, float* buf, size_t size)
+{
+    PROFILE_STAGE(PROF_PHASER);
+    size_t ch = &fx == &fx2;
+    Phaser& ph = phasers[ch];
+
+    // Control rate: one LFO step per block
+    if(ch == 1 && phaser_stereo)
+        ph.lfo_phase = phasers[0].lfo_phase + phaser_spread * (1.0f / 360.0f);
+    else
+        ph.lfo_phase += p.phaser_rate * (AUDIO_BLOCK_SIZE / SAMPLE_RATE);
+    if(ph.lfo_phase >= 1.0f)
+        ph.lfo_phase -= 1.0f;
+    if(p.phaser_mix <= 0.0f)
+        return;
+
+    // New stages start from rest
+    if(p.phaser_stages != ph.stages)
+    {
+        for(size_t k = ph.stages; k < p.phaser_stages; k++)
+            ph.state[k] = 0.0f;
+        ph.stages = p.phaser_stages;
+    }
+
+    float lfo = 0.5f + 0.5f * sinf(TWOPI_F * ph.lfo_phase);
+    float freq = PHASER_MIN_HZ * powf(PHASER_MAX_HZ / PHASER_MIN_HZ, p.phaser_depth * lfo);
+    float t = tanf(PI_F * freq / SAMPLE_RATE);
+    float target = (1.0f - t) / (1.0f + t);
+
+    float a[AUDIO_BLOCK_SIZE];
+    float step = (target - ph.coef) / size;
+    for(size_t i = 0; i < size; i++)
+        a[i] = ph.coef + step * (i + 1);
+    ph.coef = target;
+
+    // y = -a x + s, s = x + a y  (H = (-a + z^-1) / (1 - a z^-1))
+    float wet[AUDIO_BLOCK_SIZE];
+    memcpy(wet, buf, size * sizeof(float));
+    for(size_t k = 0; k < ph.stages; k++)
+    {
+        float st = ph.state[k];
+        for(size_t i = 0; i < size; i++)
+        {
+            float y = st - a[i] * wet[i];
+            st = wet[i] + a[i] * y;
+            wet[i] = y;
+        }
+        ph.state[k] = st;
+    }
+
+    // Full mix is an equal blend, where the notches are deepest
+    float amt = 0.5f * p.phaser_mix;
+    for(size_t i = 0; i < size; i++)
+        buf[i] += amt * (wet[i] - buf[i]);
+}
+
+// Delay (muted until its memory has been cleared; the ramp still runs so a
+// dip posted meanwhile completes)
+inline void DelayStage(ChannelFx& fx, const ChannelParams& p, float* buf, size_t size)
+{
+    PROFILE_STAGE(PROF_DELAY);
+    if(!fx.del_active || Bypassed(p, STAGE_DELAY))
+    {
+        fx.ramp[STAGE_DELAY].Apply(buf, size);
+        return;
+    }
+
+    constexpr float wet_step = 1.0f / RAMP_SAMPLES;
+    if(p.delay_mix > 0.0f) {
+        size_t delay_samples = static_cast<size_t>(p.delay_time * 48000.0f);
+        float wet = fx.del_wet;
+        for(size_t i = 0; i < size; i++)
+        {
+            float delayed = fx.del.Read(delay_samples);
+            fx.del.Write(buf[i] + (delayed * p.delay_feedback));
+            float mix = p.delay_mix * wet;
+            buf[i] = buf[i] * (1.0f - mix) + delayed * mix;
+            wet = fminf(wet + wet_step, 1.0f);
+        }
+        fx.del_wet = wet;
+    } else {
+        for(size_t i = 0; i < size; i++)
+            fx.del.Write(buf[i]);
+        fx.del_wet = fminf(fx.del_wet + size * wet_step, 1.0f);
+    }
+    GuardStage(fx, STAGE_DELAY, buf, size);
+    fx.ramp[STAGE_DELAY].Apply(buf, size);
+}
+
+/**
+ * Spawn the grains owed for this block (control rate)
+ * Start positions are kept far enough behind the write head that a grain
+ * never reads across it, whatever its pitch.
+ */
+void ScheduleGrains(GranularFx& g, const ChannelParams& p, uint32_t head)
+{
+    float len = p.grain_size * SAMPLE_RATE;
+    g.norm = 1.0f / sqrtf(fmaxf(1.0f, p.grain_density * p.grain_size));
+    g.spawn_phase += p.grain_density * (AUDIO_BLOCK_SIZE / SAMPLE_RATE);
+    if(g.spawn_phase < 1.0f)
+        return;
+
+    float rate = exp2f(p.grain_pitch / 12.0f);
+    float min_delay = fmaxf(rate - 1.0f, 0.0f) * len + AUDIO_BLOCK_SIZE;
+    float max_delay = GRAIN_BUFFER_SAMPLES - len - 2 * AUDIO_BLOCK_SIZE;
+    float base = min_delay + p.grain_pos * (max_delay - min_delay);
+
+    while(g.spawn_phase >= 1.0f)
+    {
+        g.spawn_phase -= 1.0f;
+        if(g.num_active >= MAX_GRAINS)
+            continue;  // Voice cap: drop the grain
+
+        g.rng = g.rng * 1664525u + 1013904223u;
+        float jitter = (g.rng >> 8) * (1.0f / 16777216.0f) * p.grain_spray * SAMPLE_RATE;
+        float delay = fclamp(base + jitter, min_delay, max_delay);
+
+        Grain& gr = g.grains[g.num_active++];
+        gr.idx = head - (uint32_t)delay;
+        gr.frac = 0.0f;
+        gr.rate = rate;
+        gr.phase = 0.0f;
+        gr.phase_inc = GRAIN_WINDOW_SIZE / len;
+    }
+}
+
+// Granular cloud (recording runs even at zero mix)
+inline void GrainStage(ChannelFx& fx, const ChannelParams& p, float* buf, size_t size)
+{
+    PROFILE_STAGE(PROF_GRAIN);
+    size_t ch = &fx == &fx2;
+    GranularFx& g = granular[ch];
+    if(!g.ready)
+        return;
+
+    float* rec = grain_buf[ch];
+    uint32_t head = g.write_pos;
+    for(size_t i = 0; i < size; i++)
+        rec[(head + i) & GRAIN_BUFFER_MASK] = buf[i];
+    g.write_pos = head + size;
+
+    // At zero mix, grains still playing run out and no new ones start
+    if(p.grain_mix > 0.0f)
+        ScheduleGrains(g, p, head);
+    else if(g.num_active == 0)
+        return;
+
+    float wet[AUDIO_BLOCK_SIZE];
+    memset(wet, 0, size * sizeof(float));
+    for(size_t n = 0; n < g.num_active;)
+    {
+        Grain& gr = g.grains[n];
+        bool done = false;
+        for(size_t i = 0; i < size; i++)
+        {
+            float a = rec[gr.idx & GRAIN_BUFFER_MASK];
+            float b = rec[(gr.idx + 1) & GRAIN_BUFFER_MASK];
+            wet[i] += (a + (b - a) * gr.frac) * grain_window[(size_t)gr.phase];
+
+            gr.frac += gr.rate;
+            uint32_t whole = (uint32_t)gr.frac;
+            gr.idx += whole;
+            gr.frac -= whole;
+            gr.phase += gr.phase_inc;
+            if(gr.phase >= GRAIN_WINDOW_SIZE)
+            {
+                done = true;
+                break;
+            }
+        }
+
+        // Finished grains are swapped out so the active list stays packed
+        if(done)
+            gr = g.grains[--g.num_active];
+        else
+            n++;
+    }
+
+    float dry = 1.0f - p.grain_mix;
+    float gain = p.grain_mix * g.norm;
+    for(size_t i = 0; i < size; i++)
+        buf[i] = buf[i] * dry + wet[i] * gain;
+}
+
+/**
+ * Through-zero flanger (chorus_depth sets the sweep, chorus_rate the LFO)
+ * One triangle LFO, one interpolated read and two writes per sample: less
+ * work than the chorus's two voices.
+ */
+inline void FlangerProcess(Flanger& f, const ChannelParams& p, float* buf, size_t size)
+{
+    float inc = p.chorus_rate * (1.0f / SAMPLE_RATE);
+    float sweep = p.chorus_depth * (FLANGER_CENTER - 1.0f);
+    float fb = p.flanger_feedback;
+    uint32_t w = f.write_pos;
+    float ph = f.lfo_phase;
+    for(size_t i = 0; i < size; i++)
+    {
+        float tri = 4.0f * fabsf(ph - 0.5f) - 1.0f;  // -1..1
+        ph += inc;
+        if(ph >= 1.0f)
+            ph -= 1.0f;
+
+        float d = FLANGER_CENTER + sweep * tri;      // 1..2 * FLANGER_CENTER - 1
+        uint32_t di = (uint32_t)d;
+        float frac = d - di;
+        float a = f.line[(w - di) & FLANGER_MASK];
+        float b = f.line[(w - di - 1) & FLANGER_MASK];
+        float wet = a + (b - a) * frac;
+        float dry = f.dry[(w - (uint32_t)FLANGER_CENTER) & FLANGER_MASK];
+
+        f.dry[w & FLANGER_MASK] = buf[i];
+        f.line[w & FLANGER_MASK] = buf[i] + fb * wet;
+        w++;
+        buf[i] = 0.5f * (dry + wet);
+    }
+    f.write_pos = w;
+    f.lfo_phase = ph;
+}
+
+// Chorus / flanger
+inline void ChorusStage(ChannelFx& fx, const ChannelParams& p, float* buf, size_t size)
+{
+    PROFILE_STAGE(PROF_CHORUS);
+    if(p.chorus_depth > 0.0f && !Bypassed(p, STAGE_CHORUS))
+    {
+        if(fx.mod_mode == MOD_FLANGER)
+            FlangerProcess(fx.mod.flanger, p, buf, size);
+        else
+            for(size_t i = 0; i < size; i++)
+                buf[i] = fx.mod.chorus.Process(buf[i]);
+        GuardStage(fx, STAGE_CHORUS, buf, size);
+    }
+    fx.ramp[STAGE_CHORUS].Apply(buf, size);
+}
+
+// Spectral freeze, crossfaded in once the first frozen frame is output
+inline void FreezeStage(ChannelFx& fx, const ChannelParams& p, float* buf, size_t size)
+{
+    PROFILE_STAGE(PROF_FREEZE);
+    SpectralFreeze& fz = freezes[&fx == &fx2];
+    float wet[AUDIO_BLOCK_SIZE];
+    fz.stft.Process(buf, wet, size);
+
+    bool hold = fz.hold;
+    if(hold && !fz.was_hold)
+        fz.capture_pending = true;  // Each new freeze takes a fresh snapshot
+    fz.was_hold = hold;
+
+    bool wet_ready = fz.frozen && (int32_t)(fz.stft.pos - fz.wet_from) >= 0;
+    float target = (hold && wet_ready) ? 1.0f : 0.0f;
+    if(target == 0.0f && fz.fade == 0.0f)
+    {
+        if(!hold)
+            fz.frozen = false;
+        return;
+    }
+
+    constexpr float step = 1.0f / FREEZE_FADE_SAMPLES;
+    float fade = fz.fade;
+    for(size_t i = 0; i < size; i++)
+    {
+        fade = target > fade ? fminf(fade + step, 1.0f) : fmaxf(fade - step, 0.0f);
+        buf[i] = buf[i] * (1.0f - fade * p.freeze_mix) + wet[i] * fade;
+    }
+    fz.fade = fade;
+}
+
+/**
+ * Process one block through a channel chain
+ *
+ * Gain → Drive → Swell → Filter → Phaser → Delay → Grains → Chorus → Freeze
+ * mod is the opposite input, used for cross-modulation of the filter.
+ */
+void ProcessChannel(ChannelFx& fx, const ChannelParams& p, const float* in, const float* mod,
+                    float* out, size_t size)
+{
+    uint32_t tap = &fx == &fx2 ? SCOPE_CH2_DRIVE : SCOPE_CH1_DRIVE;
+    DriveStage(fx, p, in, out, size);
+    ScopeTap(tap, out, size);
+    OnsetStage(fx, p, in, out, size);
+    FilterStage(fx, p, mod, out, size);
+    ScopeTap(tap + 1, out, size);
+    PhaserStage(fx, p, out, size);
+    DelayStage(fx, p, out, size);
+    ScopeTap(tap + 2, out, size);
+    GrainStage(fx, p, out, size);
+    ChorusStage(fx, p, out, size);
+    FreezeStage(fx, p, out, size);
+}
+
+/**
+ * Advance a rotor by one block and work out its delay and mic gains at
+ * the end of the block (the sample loop ramps to them)
+ */
+inline void RotorStep(Rotor& r, float mic_half)
+{
+    float target = rotary_fast ? r.fast_hz : r.slow_hz;
+    r.speed += (target - r.speed) * r.accel;
+    r.angle += r.speed * (AUDIO_BLOCK_SIZE / SAMPLE_RATE);
+    if(r.angle >= 1.0f)
+        r.angle -= 1.0f;
+
+    float a = TWOPI_F * r.angle;
+    r.delay = 1.0f + r.doppler * (1.0f + sinf(a));
+    r.gain[0] = 1.0f - r.am * 0.5f * (1.0f - cosf(a + mic_half));
+    r.gain[1] = 1.0f - r.am * 0.5f * (1.0f - cosf(a - mic_half));
+}
+
+inline float RotorRead(const Rotor& r, uint32_t w, float d)
+{
+    uint32_t di = (uint32_t)d;
+    float frac = d - di;
+    float a = r.buf[(w - di) & ROTARY_MASK];
+    float b = r.buf[(w - di - 1) & ROTARY_MASK];
+    return a + (b - a) * frac;
+}
+
+// Rotary speaker on the stereo output (rotors keep turning while it is off)
+inline void RotaryStage(float* const* out, size_t size)
+{
+    PROFILE_STAGE(PROF_ROTARY);
+    RotarySpeaker& rs = rotary;
+    Rotor& horn = rs.horn;
+    Rotor& drum = rs.drum;
+
+    float h_delay = horn.delay, h_l = horn.gain[0], h_r = horn.gain[1];
+    float d_delay = drum.delay, d_l = drum.gain[0], d_r = drum.gain[1];
+    float mic_half = rotary_mic_angle * (PI_F / 360.0f);
+    RotorStep(horn, mic_half);
+    RotorStep(drum, mic_half);
+
+    if(rotary_mix <= 0.0f)
+    {
+        rs.active = false;
+        return;
+    }
+    if(!rs.active)
+    {
+        // Stale audio from the last time the stage ran
+        memset(horn.buf, 0, sizeof(horn.buf));
+        memset(drum.buf, 0, sizeof(drum.buf));
+        rs.active = true;
+    }
+
+    float k = 1.0f / size;
+    float h_delay_inc = (horn.delay - h_delay) * k;
+    float h_l_inc = (horn.gain[0] - h_l) * k, h_r_inc = (horn.gain[1] - h_r) * k;
+    float d_delay_inc = (drum.delay - d_delay) * k;
+    float d_l_inc = (drum.gain[0] - d_l) * k, d_r_inc = (drum.gain[1] - d_r) * k;
+
+    float c = rs.xover_coef;
+    float lp0 = rs.lp[0], lp1 = rs.lp[1];
+    uint32_t w = rs.write_pos;
+    for(size_t i = 0; i < size; i++)
+    {
+        float x = 0.5f * (out[0][i] + out[1][i]);
+        lp0 += c * (x - lp0);
+        lp1 += c * (lp0 - lp1);
+        horn.buf[w & ROTARY_MASK] = x - lp1;
+        drum.buf[w & ROTARY_MASK] = lp1;
+
+        h_delay += h_delay_inc;
+        d_delay += d_delay_inc;
+        float h = RotorRead(horn, w, h_delay);
+        float d = RotorRead(drum, w, d_delay);
+        w++;
+
+        h_l += h_l_inc;
+        h_r += h_r_inc;
+        d_l += d_l_inc;
+        d_r += d_r_inc;
+        out[0][i] += rotary_mix * (h * h_l + d * d_l - out[0][i]);
+        out[1][i] += rotary_mix * (h * h_r + d * d_r - out[1][i]);
+    }
+    rs.lp[0] = lp0;
+    rs.lp[1] = lp1;
+    rs.write_pos = w;
+}
+
+// Feedback notches on the output (only active slots cost anything)
+inline void NotchStage(float* const* out, size_t size)
+{
+    PROFILE_STAGE(PROF_NOTCH);
+    NotchBank& nb = notch_bank;
+    if(notch_update)
+    {
+        memcpy(nb.coef, notch_pending, sizeof(nb.coef));
+        for(size_t k = 0; k < MAX_FEEDBACK_NOTCHES; k++)
+            if(notch_pending_reset & (1u << k))
+                for(size_t c = 0; c < NUM_OUTPUTS; c++)
+                    nb.z1[c][k] = nb.z2[c][k] = 0.0f;
+        nb.active = notch_pending_active;
+        notch_update = false;
+    }
+
+    for(uint32_t mask = nb.active; mask; mask &= mask - 1)
+    {
+        size_t k = __builtin_ctz(mask);
+        const NotchCoefs q = nb.coef[k];
+        for(size_t c = 0; c < NUM_OUTPUTS; c++)
+        {
+            float z1 = nb.z1[c][k], z2 = nb.z2[c][k];
+            float* buf = out[c];
+            for(size_t i = 0; i < size; i++)
+            {
+                float x = buf[i];
+                float y = q.b0 * x + z1;
+                z1 = q.b1 * x - q.a1 * y + z2;
+                z2 = q.b2 * x - q.a2 * y;
+                buf[i] = y;
+            }
+            nb.z1[c][k] = z1;
+            nb.z2[c][k] = z2;
+        }
+    }
+}
+
+// Mono copy of the output for the main loop's feedback analysis
+inline void FeedbackCapture(float* const* out, size_t size)
+{
+    if(!feedback_detect)
+        return;
+    uint32_t w = feedback_write_pos;
+    for(size_t i = 0; i < size; i++)
+        feedback.ring[(w + i) & (FBD_RING - 1)] = 0.5f * (out[0][i] + out[1][i]);
+    feedback_write_pos = w + size;
+}
+
+// Raw inputs and final outputs into the black box ring
+inline void BlackboxRecord(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size)
+{
+    BlackboxState& bb = blackbox_state;
+    if(bb.frozen)
+        return;
+
+    BlackboxBlock& b = blackbox[bb.head % BLACKBOX_BLOCKS];
+    const float* src[BLACKBOX_CHANNELS] = {in[0], in[1], out[0], out[1]};
+    for(size_t c = 0; c < BLACKBOX_CHANNELS; c++)
+    {
+#ifdef BLACKBOX_FLOAT
+        memcpy(b.planes[c], src[c], size * sizeof(float));
+#else
+        arm_float_to_q15(src[c], b.planes[c], size);  // Saturates
+#endif
+    }
+    bb.head++;
+
+    if(bb.reason != BLACKBOX_NONE && --bb.post == 0)
+        bb.frozen = true;
+}
+
+/**
+ * Audio Callback - Dual Channel Processing
+ *
+ * SIGNAL FLOW PER CHANNEL:
+ * Guitar In → Gain → Drive → Filter → Delay → Chorus → Mix Bus
+ *
+ * OUTPUT:
+ * Mix Buses → Mix Matrix (pan/bleed/width/balance/gain) → Soft Clip → Out
+ *
+ * CROSS-CHANNEL:
+ * - Channel 1 can modulate Channel 2 filter frequency
+ * - Channel 2 can modulate Channel 1 filter frequency
+ * - Cross-bleed mixes channels together (via the mix matrix)
+ *
+ * One instantiation per RoutingMode; MODE is a compile-time constant so the
+ * routing branches below fold away and the sample loops carry no mode checks.
+ */
+template <RoutingMode MODE>
+void AudioCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size)
+{
+    PROFILE_COMMIT_BLOCK();
+    PROFILE_STAGE(PROF_CALLBACK);
+
+    // A gap well past one block period means a block was missed
+    uint32_t block_start = Cycles();
+    uint32_t since_last = block_start - last_block_start;
+    if(first_audio_us != 0 && since_last > block_period_cycles + block_period_cycles / 2)
+    {
+        overrun_count = overrun_count + 1;
+        Trace(TRACE_OVERRUN, 0, (float)since_last);
+        BlackboxTrigger(BLACKBOX_OVERRUN);
+    }
+    last_block_start = block_start;
+
+    if(first_audio_us == 0)
+        first_audio_us = System::GetUs();
+
+    // Control rate: rebuild the mix matrix only when routing params changed
+    if(mix_matrix_dirty)
+    {
+        mix_matrix_dirty = false;
+        ComputeMixMatrix();
+    }
+
+    // Stereo-linked mode drives both chains from channel 1's settings
+    const ChannelParams& p1 = ch1_params;
+    const ChannelParams& p2 = (MODE == ROUTING_STEREO_LINKED) ? ch1_params : ch2_params;
+    PrepareChannel(fx1, p1);
+    PrepareChannel(fx2, p2);
+
+    // ========== READ INPUTS ==========
+    // Validate per block (protect against NaN/Inf)
+    for(size_t c = 0; c < 2; c++)
+    {
+        memcpy(in_buf[c], in[c], size * sizeof(float));
+        if(BlockUnstable(in_buf[c], size))
+        {
+            memset(in_buf[c], 0, size * sizeof(float));
+            input_faults = input_faults + 1;
+            Trace(TRACE_STAGE_RESET, 0xF0);
+            BlackboxTrigger(BLACKBOX_INPUT_FAULT);
+        }
+    }
+
+    // Hum is removed before anything (drive especially) spreads it
+    float* inputs[2] = {in_buf[0], in_buf[1]};
+    hum.Process(inputs, size, hum_cancel, hum_harmonics);
+
+    // ========== CHANNEL PROCESSING ==========
+    ProcessChannel(fx1, p1, in_buf[0], in_buf[1], mix_bus[0], size);
+
+    if(MODE == ROUTING_SERIES)
+    {
+        // Chain 1 feeds chain 2; result goes to both buses
+        ProcessChannel(fx2, p2, mix_bus[0], in_buf[0], mix_bus[1], size);
+        memcpy(mix_bus[0], mix_bus[1], size * sizeof(float));
+    }
+    else if(MODE == ROUTING_PARALLEL)
+    {
+        // Both chains share input 1, so chain 2 is cross-modulated by chain 1's output
+        ProcessChannel(fx2, p2, in_buf[0], mix_bus[0], mix_bus[1], size);
+    }
+    else if(MODE == ROUTING_VOCODER)
+    {
+        // Chain 1 shapes the modulator, chain 2 the carrier (drive adds harmonics)
+        ProcessChannel(fx2, p2, in_buf[1], in_buf[0], mix_bus[1], size);
+        PROFILE_STAGE(PROF_VOCODER);
+        vocoder.SetRelease(vocoder_release);
+        vocoder.Process(mix_bus[0], mix_bus[1], mix_bus[0], size);
+        memcpy(mix_bus[1], mix_bus[0], size * sizeof(float));
+    }
+    else if(MODE == ROUTING_CROSS_SYNTH)
+    {
+        // Chain 2 is the carrier, chain 1 the envelope source
+        ProcessChannel(fx2, p2, in_buf[1], in_buf[0], mix_bus[1], size);
+        PROFILE_STAGE(PROF_XSYNTH);
+        xsynth.morph = xsynth_morph;
+        xsynth.stft.Process(mix_bus[1], mix_bus[0], size, mix_bus[0]);
+        memcpy(mix_bus[1], mix_bus[0], size * sizeof(float));
+    }
+    else
+    {
+        ProcessChannel(fx2, p2, in_buf[1], in_buf[0], mix_bus[1], size);
+    }
+
+    // ========== OUTPUT MIX MATRIX ==========
+    // Bleed, width, balance, pan and gain in one multiply-accumulate pass
+    {
+        PROFILE_STAGE(PROF_MIX);
+        float m[NUM_OUTPUTS][NUM_MIX_BUSES];
+        memcpy(m, mix_matrix, sizeof(m));
+
+        for(size_t i = 0; i < size; i++)
+        {
+            float l = 0.0f;
+            float r = 0.0f;
+            for(size_t b = 0; b < NUM_MIX_BUSES; b++)
+            {
+                l += m[0][b] * mix_bus[b][i];
+                r += m[1][b] * mix_bus[b][i];
+            }
+            out[0][i] = l;
+            out[1][i] = r;
+        }
+    }
+
+    RotaryStage(out, size);
+    NotchStage(out, size);
+
+    // ========== MASTER OUTPUT ==========
+    {
+        PROFILE_STAGE(PROF_MASTER);
+        for(size_t c = 0; c < NUM_OUTPUTS; c++)
+        {
+            for(size_t i = 0; i < size; i++)
+                out[c][i] = MySoftClip(out[c][i]);
+
+            // Final safety check (per block)
+            if(BlockUnstable(out[c], size))
+            {
+                memset(out[c], 0, size * sizeof(float));
+                output_faults = output_faults + 1;
+                Trace(TRACE_STAGE_RESET, 0xF1);
+                BlackboxTrigger(BLACKBOX_OUTPUT_FAULT);
+            }
+        }
+
+        // Global start/mute fade
+        output_ramp.Apply(out, NUM_OUTPUTS, size);
+    }
+    ScopeTap(SCOPE_OUT_L, out[0], size);
+    ScopeTap(SCOPE_OUT_R, out[1], size);
+    FeedbackCapture(out, size);
+    BlackboxRecord(in, out, size);
+
+    sample_clock = sample_clock + size;
+    SignalMain(EVENT_AUDIO_BLOCK);
+
+    uint32_t elapsed = Cycles() - block_start;
+    if(elapsed > block_period_cycles)
+    {
+        overrun_count = overrun_count + 1;
+        Trace(TRACE_OVERRUN, 1, (float)elapsed);
+        BlackboxTrigger(BLACKBOX_OVERRUN);
+    }
+}
+
+// Callback per routing mode, indexed by RoutingMode
+const AudioHandle::AudioCallback routing_callbacks[NUM_ROUTING_MODES] = {
+    AudioCallback<ROUTING_DUAL_MONO>,
+    AudioCallback<ROUTING_SERIES>,
+    AudioCallback<ROUTING_PARALLEL>,
+    AudioCallback<ROUTING_STEREO_LINKED>,
+    AudioCallback<ROUTING_VOCODER>,
+    AudioCallback<ROUTING_CROSS_SYNTH>,
+};
+
+/**
+ * Switch routing topology
+ * The callback pointer is swapped atomically; the new mode takes effect
+ * at the next audio block boundary. Cross-synthesis starts from empty
+ * rings so its first LATENCY samples are silence, not overlap-add left
+ * over from the last time the mode ran.
+ */
+void SetRoutingMode(RoutingMode mode)
+{
+    if(mode == ROUTING_CROSS_SYNTH)
+        xsynth.stft.Reset(sample_clock);
+    routing_mode = mode;
+    hw.ChangeAudioCallback(routing_callbacks[mode]);
+}
+
+// Ramp actions (run in the audio callback while the stage is silent)
+void ApplyFilterMode(void* ctx, int mode)
+{
+    static_cast<ChannelParams*>(ctx)->filter_mode = (FilterMode)mode;
+}
+
+void ApplyChorusMode(void* ctx, int mode)
+{
+    static_cast<ChannelParams*>(ctx)->chorus_mode = (ModMode)mode;
+}
+
+void ApplyRoutingMode(void*, int mode)
+{
+    SetRoutingMode((RoutingMode)mode);
+}
+
+// arg = stage | on << 8
+void ApplyBypass(void* ctx, int arg)
+{
+    ChannelParams* p = static_cast<ChannelParams*>(ctx);
+    uint32_t bit = 1u << (arg & 0xFF);
+    p->bypass = (arg >> 8) ? (p->bypass | bit) : (p->bypass & ~bit);
+    Trace(TRACE_BYPASS, (p == &ch2_params) << 4 | (arg & 0xFF), (float)(arg >> 8));
+}
+
+/**
+ * Run a channel param change behind a short dip of one stage
+ */
+void DipStage(int ch, ChannelStage stage, RampAction action, int arg)
+{
+    ChannelParams& p = (ch == 0) ? ch1_params : ch2_params;
+    ChannelFx& fx = (ch == 0) ? fx1 : fx2;
+    fx.ramp[stage].Post(GainRamp::DIP, action, &p, arg);
+
+    // Linked mode: chain 2 also follows channel 1's params
+    if(ch == 0 && routing_mode == ROUTING_STEREO_LINKED)
+        fx2.ramp[stage].Post(GainRamp::DIP);
+}
+
+void SetFilterModeRamped(int ch, FilterMode mode)
+{
+    DipStage(ch, STAGE_FILTER, ApplyFilterMode, mode);
+}
+
+void SetChorusModeRamped(int ch, ModMode mode)
+{
+    DipStage(ch, STAGE_CHORUS, ApplyChorusMode, mode);
+}
+
+/**
+ * Set a channel's stage bypass mask; each changed stage dips on its own
+ */
+void SetBypassRamped(int ch, uint32_t mask)
+{
+    const ChannelParams& p = (ch == 0) ? ch1_params : ch2_params;
+    for(int s = 0; s < NUM_CHANNEL_STAGES; s++)
+    {
+        uint32_t bit = 1u << s;
+        if((p.bypass ^ mask) & bit)
+            DipStage(ch, (ChannelStage)s, ApplyBypass, s | ((mask & bit) ? 0x100 : 0));
+    }
+}
+
+/**
+ * Freeze or release a channel (linked mode: channel 1 drives both chains)
+ */
+void SetFreeze(int ch, bool on)
+{
+    freezes[ch].hold = on;
+    if(ch == 0 && routing_mode == ROUTING_STEREO_LINKED)
+        freezes[1].hold = on;
+}
+
+/**
+ * Change routing behind a dip of the whole output (direct when muted)
+ */
+void SetRoutingModeRamped(RoutingMode mode)
+{
+    if(output_muted)
+        SetRoutingMode(mode);
+    else
+        output_ramp.Post(GainRamp::DIP, ApplyRoutingMode, nullptr, mode);
+}
+
+/**
+ * Queue a memory region to be zeroed from the main loop
+ * ready is cleared now and set once the whole region is zero.
+ * Returns false (ready untouched) when the queue is full.
+ */
+bool QueueClear(void* base, size_t size, volatile bool* ready)
+{
+    if(num_clear_jobs >= MAX_CLEAR_JOBS)
+        return false;
+    *ready = false;
+    // Byte-wise access keeps this usable for any object (DelayLine has no chunked Reset)
+    clear_jobs[num_clear_jobs++] = {reinterpret_cast<uint8_t*>(base), size, 0, ready};
+    return true;
+}
+
+/**
+ * Clear up to CLEAR_CHUNK_BYTES of the oldest pending job
+ * Returns true while work remains.
+ */
+bool ServiceClearJobs()
+{
+    if(num_clear_jobs == 0)
+        return false;
+
+    ClearJob& job = clear_jobs[0];
+    size_t n = job.size - job.done;
+    if(n > CLEAR_CHUNK_BYTES)
+        n = CLEAR_CHUNK_BYTES;
+    memset(job.base + job.done, 0, n);
+    job.done += n;
+
+    if(job.done >= job.size)
+    {
+        *job.ready = true;
+        num_clear_jobs--;
+        memmove(&clear_jobs[0], &clear_jobs[1], num_clear_jobs * sizeof(ClearJob));
+    }
+    return num_clear_jobs > 0;
+}
+
+/**
+ * Hand a buffer to the USB stack, retrying briefly while it is busy
+ * The buffer is read asynchronously and must outlive the transfer.
+ */
+bool UsbTransmit(const void* data, size_t size)
+{
+    for(int tries = 0; tries < 20; tries++)
+    {
+        if(hw.usb_handle.TransmitInternal((uint8_t*)data, size) == UsbHandle::Result::OK)
+            return true;
+        System::DelayUs(50);
+    }
+    return false;
+}
+
+// Binary dump in progress: header line, then raw bytes in chunks
+struct UsbDump
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    size_t sent = 0;
+    void (*on_done)() = nullptr;  // e.g. release a frozen buffer
+};
+
+UsbDump usb_dump;
+
+// Text lines held back while a dump streams, sent in order once it is done
+constexpr size_t TX_QUEUE_LINES = 4;
+
+struct TxQueue
+{
+    char lines[TX_QUEUE_LINES][256];
+    uint8_t len[TX_QUEUE_LINES];
+    size_t count = 0;
+    uint32_t dropped = 0;               // Lines lost to a full queue
+};
+
+TxQueue tx_queue;
+
+/**
+ * Send the lines queued during a dump, then report any that did not fit
+ */
+void FlushTxQueue()
+{
+    for(size_t i = 0; i < tx_queue.count; i++)
+        UsbTransmit(tx_queue.lines[i], tx_queue.len[i]);
+    tx_queue.count = 0;
+
+    if(tx_queue.dropped)
+    {
+        static char msg[32];
+        int len = snprintf(msg, sizeof(msg), "tx:dropped=%lu\n",
+                           (unsigned long)tx_queue.dropped);
+        tx_queue.dropped = 0;
+        UsbTransmit(msg, (size_t)len);
+    }
+}
+
+/**
+ * Send a text line back to the host over USB Serial
+ * Queued while a binary dump is streaming so the two never interleave;
+ * the queue goes out ahead of the next line once the dump is done.
+ */
+bool SendLine(const char* line)
+{
+    // Alternate buffers: the previous line may still be in flight
+    static char tx_buf[2][256];
+    static int tx_idx = 0;
+
+    if(usb_dump.data)
+    {
+        if(tx_queue.count >= TX_QUEUE_LINES)
+        {
+            tx_queue.dropped++;
+            return false;
+        }
+        char* q = tx_queue.lines[tx_queue.count];
+        int len = snprintf(q, sizeof(tx_queue.lines[0]), "%s\n", line);
+        if(len <= 0)
+            return false;
+        if(len >= (int)sizeof(tx_queue.lines[0]))
+            len = sizeof(tx_queue.lines[0]) - 1;
+        tx_queue.len[tx_queue.count++] = (uint8_t)len;
+        return true;
+    }
+    if(tx_queue.count || tx_queue.dropped)
+        FlushTxQueue();
+
+    char* msg = tx_buf[tx_idx];
+    tx_idx ^= 1;
+    int len = snprintf(msg, sizeof(tx_buf[0]), "%s\n", line);
+    if(len <= 0)
+        return false;
+    if(len >= (int)sizeof(tx_buf[0]))
+        len = sizeof(tx_buf[0]) - 1;
+    return UsbTransmit(msg, (size_t)len);
+}
+
+/**
+ * Start a binary dump: "!<tag>:size=<n>[,<meta>]" followed by n raw bytes
+ * The data must stay valid until ServiceUsbDump has sent it all.
+ */
+bool StartDump(const char* tag, const char* meta, const void* data, size_t size,
+               void (*on_done)() = nullptr)
+{
+    if(usb_dump.data)
+        return false;
+
+    char header[160];
+    if(meta)
+        snprintf(header, sizeof(header), "!%s:size=%lu,%s", tag, (unsigned long)size, meta);
+    else
+        snprintf(header, sizeof(header), "!%s:size=%lu", tag, (unsigned long)size);
+    if(!SendLine(header))
+        return false;
+
+    usb_dump.data = static_cast<const uint8_t*>(data);
+    usb_dump.size = size;
+    usb_dump.sent = 0;
+    usb_dump.on_done = on_done;
+    return true;
+}
+
+/**
+ * Send the next chunk of the active dump (main loop, never blocks long)
+ * A chunk is read by the USB stack until the next one is accepted, so the
+ * last chunk goes out from a copy: on_done may release the source memory
+ * (and restart recording into it) while that chunk is still in flight.
+ * Returns true while a dump is in progress.
+ */
+bool ServiceUsbDump()
+{
+    static uint8_t last_chunk[USB_DUMP_CHUNK];
+
+    if(!usb_dump.data)
+        return false;
+
+    size_t n = usb_dump.size - usb_dump.sent;
+    if(n > USB_DUMP_CHUNK)
+        n = USB_DUMP_CHUNK;
+    const uint8_t* chunk = usb_dump.data + usb_dump.sent;
+    if(usb_dump.sent + n >= usb_dump.size)
+    {
+        memcpy(last_chunk, chunk, n);
+        chunk = last_chunk;
+    }
+    if(hw.usb_handle.TransmitInternal(const_cast<uint8_t*>(chunk), n) == UsbHandle::Result::OK)
+        usb_dump.sent += n;
+
+    if(usb_dump.sent >= usb_dump.size)
+    {
+        usb_dump.data = nullptr;
+        if(usb_dump.on_done)
+            usb_dump.on_done();
+        FlushTxQueue();
+    }
+    return usb_dump.data != nullptr;
+}
+
+/**
+ * Report boot timing (all values in microseconds since hw.Init)
+ */
+void SendBootReport()
+{
+    char line[128];
+    snprintf(line, sizeof(line), "boot:first_audio_us=%lu,delay_ready_us=%lu,usb_ready_us=%lu",
+             (unsigned long)first_audio_us, (unsigned long)delay_ready_us,
+             (unsigned long)usb_ready_us);
+    SendLine(line);
+}
+
+/**
+ * Report command latency and main loop idle time since the last report
+ * (dropped counts lines lost to a full receive queue since boot)
+ */
+void SendLatencyReport()
+{
+    LoopStats& ls = loop_stats;
+    uint32_t window = System::GetUs() - ls.since;
+    char line[128];
+    snprintf(line, sizeof(line), "latency:commands=%lu,avg_us=%lu,max_us=%lu,idle_pct=%lu,dropped=%lu",
+             (unsigned long)ls.commands,
+             (unsigned long)(ls.commands ? ls.latency_total / ls.commands : 0),
+             (unsigned long)ls.latency_max,
+             (unsigned long)(window ? (uint64_t)ls.idle * 100 / window : 0),
+             (unsigned long)serial_dropped);
+    SendLine(line);
+
+    ls.commands = 0;
+    ls.latency_max = 0;
+    ls.latency_total = 0;
+    ls.idle = 0;
+    ls.since = System::GetUs();
+}
+
+/**
+ * Report one scheduler task's statistics since boot (index in table order)
+ */
+void SendSchedReport(int index)
+{
+    char line[160];
+    if(index < 0 || index >= (int)sched_num)
+    {
+        snprintf(line, sizeof(line), "sched:tasks=%d,restarts=%lu", (int)sched_num,
+                 (unsigned long)sched_restarts);
+        SendLine(line);
+        return;
+    }
+
+    const Task& t = sched_tasks[index];
+    uint32_t cycles_per_us = System::GetSysClkFreq() / 1000000;
+    snprintf(line, sizeof(line),
+             "sched:tasks=%d,task=%d,priority=%d,runs=%lu,overruns=%lu,avg_us=%lu,max_us=%lu,budget_us=%lu",
+             (int)sched_num, index, (int)t.priority, (unsigned long)t.runs,
+             (unsigned long)t.overruns,
+             (unsigned long)(t.runs ? t.total_cycles / t.runs / cycles_per_us : 0),
+             (unsigned long)(t.max_cycles / cycles_per_us), (unsigned long)t.budget_us);
+    SendLine(line);
+}
+
+/**
+ * Report instability resets per stage since boot
+ */
+void SendFaultReport()
+{
+    char line[224];
+    snprintf(line, sizeof(line),
+             "faults:input=%lu,ch1_drive=%lu,ch1_filter=%lu,ch1_delay=%lu,ch1_chorus=%lu,"
+             "ch2_drive=%lu,ch2_filter=%lu,ch2_delay=%lu,ch2_chorus=%lu,output=%lu",
+             (unsigned long)input_faults,
+             (unsigned long)fx1.faults[STAGE_DRIVE], (unsigned long)fx1.faults[STAGE_FILTER],
+             (unsigned long)fx1.faults[STAGE_DELAY], (unsigned long)fx1.faults[STAGE_CHORUS],
+             (unsigned long)fx2.faults[STAGE_DRIVE], (unsigned long)fx2.faults[STAGE_FILTER],
+             (unsigned long)fx2.faults[STAGE_DELAY], (unsigned long)fx2.faults[STAGE_CHORUS],
+             (unsigned long)output_faults);
+    SendLine(line);
+}
+
+// Report the mains hum tracker state and residual level per input
+void SendHumReport()
+{
+    char line[128];
+    snprintf(line, sizeof(line), "hum:state=%d,mains_mhz=%lu,ch1_db=%d,ch2_db=%d",
+             (int)hum.state, (unsigned long)(hum.f0 * 1000.0f),
+             (int)(20.0f * log10f(hum.Level(0) + 1e-6f)),
+             (int)(20.0f * log10f(hum.Level(1) + 1e-6f)));
+    SendLine(line);
+}
+
+// Dump finished: start recording again
+void ReleaseBlackbox()
+{
+    blackbox_state.reason = BLACKBOX_NONE;
+    blackbox_state.frozen = false;
+}
+
+/**
+ * Stream the black box capture, freezing it first if it is still running
+ * Layout: BlackboxBlock[BLACKBOX_BLOCKS] (planes in1, in2, out1, out2);
+ * the oldest block is at head % blocks once the ring has wrapped.
+ */
+void SendBlackboxDump()
+{
+    BlackboxState& bb = blackbox_state;
+    if(usb_dump.data)
+    {
+        SendLine("blackbox:busy");
+        return;
+    }
+
+    // Trigger and freeze in one step so the callback cannot record a block
+    // (or count down post) in between
+    bool froze_here = false;
+    bool triggered_here = false;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    if(!bb.frozen)
+    {
+        triggered_here = bb.reason == BLACKBOX_NONE;
+        BlackboxTrigger(BLACKBOX_MANUAL, 0);
+        bb.frozen = true;
+        froze_here = true;
+    }
+    __set_PRIMASK(primask);
+
+    char meta[128];
+    snprintf(meta, sizeof(meta), "blocks=%lu,block=%d,channels=%d,bits=%d,rate=%d,head=%lu,trigger=%lu,reason=%lu",
+             (unsigned long)BLACKBOX_BLOCKS, (int)AUDIO_BLOCK_SIZE, (int)BLACKBOX_CHANNELS,
+             (int)(8 * sizeof(BlackboxSample)), (int)SAMPLE_RATE, (unsigned long)bb.head,
+             (unsigned long)bb.trigger_block, (unsigned long)bb.reason);
+    if(!StartDump("blackbox", meta, blackbox, sizeof(blackbox), ReleaseBlackbox))
+    {
+        // Undo only our own freeze: a manual trigger is dropped, while a
+        // fault capture still counting its aftermath carries on
+        if(triggered_here)
+            ReleaseBlackbox();
+        else if(froze_here)
+            bb.frozen = false;
+        SendLine("blackbox:busy");
+    }
+}
+
+/**
+ * Arm the scope with the current scope_* settings (restarts a pending capture)
+ */
+void ArmScope()
+{
+    Scope& sc = scope;
+    if(sc.state == SCOPE_SENDING)
+        return;
+    sc.point = SCOPE_OFF;  // Hidden from the callback while it is reset
+    sc.source = sc.tap;
+    sc.window = sc.len;
+    sc.written = 0;
+    sc.prev = INFINITY;    // No edge on the first sample
+    sc.state = SCOPE_ARMED;
+    sc.point = sc.source;
+}
+
+void CancelScope()
+{
+    scope.point = SCOPE_OFF;
+    if(scope.state != SCOPE_SENDING)
+        scope.state = SCOPE_IDLE;
+}
+
+// Dump finished: back to idle until the next scope_arm
+void ReleaseScope()
+{
+    scope.state = SCOPE_IDLE;
+}
+
+/**
+ * Stream a finished capture once (main loop)
+ * Layout: float[count], the oldest sample at head % len once written > len;
+ * trigger is the index of the trigger sample in unrolled order.
+ */
+void ServiceScope()
+{
+    Scope& sc = scope;
+    if(sc.state != SCOPE_DONE)
+        return;
+
+    uint32_t count = sc.written < sc.window ? sc.written : sc.window;
+    char meta[128];
+    snprintf(meta, sizeof(meta), "tap=%lu,len=%lu,head=%lu,trigger=%lu,rate=%d",
+             (unsigned long)sc.source, (unsigned long)sc.window, (unsigned long)sc.written,
+             (unsigned long)(sc.trigger - (sc.written - count)), (int)SAMPLE_RATE);
+    if(StartDump("scope", meta, scope_buf, count * sizeof(float), ReleaseScope))
+        sc.state = SCOPE_SENDING;
+}
+
+void SendBlackboxReport()
+{
+    const BlackboxState& bb = blackbox_state;
+    char line[96];
+    snprintf(line, sizeof(line), "blackbox:frozen=%d,reason=%lu,recorded_ms=%lu",
+             (int)bb.frozen, (unsigned long)bb.reason,
+             (unsigned long)((bb.head < BLACKBOX_BLOCKS ? bb.head : BLACKBOX_BLOCKS)
+                             * AUDIO_BLOCK_SIZE * 1000 / (uint32_t)SAMPLE_RATE));
+    SendLine(line);
+}
+
+/**
+ * Dump the per-stage cycle histograms
+ * Layout: uint32 counts[stage][bucket], stages in ProfileStage order
+ */
+void SendProfileDump()
+{
+#ifdef STAGE_PROFILING
+    memcpy(prof_snapshot, prof_hist, sizeof(prof_snapshot));
+    char meta[48];
+    snprintf(meta, sizeof(meta), "stages=%d,buckets=%d", (int)NUM_PROF_STAGES, (int)PROF_BUCKETS);
+    if(!StartDump("prof", meta, prof_snapshot, sizeof(prof_snapshot)))
+        SendLine("prof:busy");
+#else
+    SendLine("prof:disabled");
+#endif
+}
+
+void ReleaseTrace() { trace_frozen = false; }
+
+/**
+ * Dump the trace ring, frozen until the transfer completes
+ * Layout: TraceEvent[TRACE_EVENTS] (uint32 cycles, uint16 type, uint16 arg,
+ * float value); head is the total event count, so the oldest event is at
+ * head % events once the ring has wrapped.
+ */
+void SendTraceDump()
+{
+    trace_frozen = true;
+    char meta[96];
+    snprintf(meta, sizeof(meta), "events=%d,head=%lu,now=%lu,cpu_hz=%lu", (int)TRACE_EVENTS,
+             (unsigned long)trace_head, (unsigned long)Cycles(),
+             (unsigned long)System::GetSysClkFreq());
+    if(!StartDump("trace", meta, trace_ring, sizeof(trace_ring), ReleaseTrace))
+    {
+        trace_frozen = false;
+        SendLine("trace:busy");
+    }
+}
+
+/**
+ * USB Receive Callback - Called when data arrives via USB Serial
+ */
+void UsbCallback(uint8_t* buf, uint32_t* len)
+{
+    for(uint32_t i = 0; i < *len; i++)
+    {
+        char c = buf[i];
+
+        if(c == '\n' || c == ';' || c == '\r')
+        {
+            // "name:value;\n" ends twice: the empty second line is skipped
+            if(buf_pos == 0)
+                continue;
+            serial_buf[buf_pos] = '\0';
+            buf_pos = 0;
+
+            uint32_t head = serial_head;
+            if(head - serial_tail >= SERIAL_QUEUE_LINES)
+            {
+                serial_dropped = serial_dropped + 1;
+                continue;
+            }
+            SerialLine& line = serial_lines[head & (SERIAL_QUEUE_LINES - 1)];
+            memcpy(line.text, serial_buf, sizeof(line.text));
+            line.rx_us = System::GetUs();
+            __DMB();  // Line contents before the new head
+            serial_head = head + 1;
+            SignalMain(EVENT_USB_RX);
+        }
+        else
+        {
+            if(buf_pos < (int)SERIAL_LINE_LEN - 1)
+            {
+                serial_buf[buf_pos++] = c;
+            }
+            else
+            {
+                // Buffer overflow protection - reset on overflow
+                buf_pos = 0;
+            }
+        }
+    }
+}
+
+// --- PERSISTENT STATE ---
+// The last state lives in a log of fixed-size records at the end of QSPI.
+// Each save appends to the next slot and the log walks the whole region
+// before a sector is reused, so erases are spread evenly (wear levelling).
+// At boot the valid record with the highest sequence number wins.
+constexpr uint32_t QSPI_BASE = 0x90000000;
+constexpr uint32_t STATE_REGION_OFFSET = 0x7F0000;  // Last 64 KB of the 8 MB flash
+constexpr uint32_t STATE_SECTOR_BYTES = 4096;
+constexpr uint32_t STATE_SECTORS = 16;
+constexpr uint32_t STATE_SLOT_BYTES = 512;         // Two program pages per record
+constexpr uint32_t STATE_SLOTS = STATE_SECTORS * STATE_SECTOR_BYTES / STATE_SLOT_BYTES;
+constexpr uint32_t STATE_MAGIC = 0x54535044;       // "DPST"
+// Bump STATE_VERSION on every ParamState layout change (fields added, removed,
+// reordered or retyped). The size in the low half only catches some of them;
+// a same-size change would otherwise load stale flash with a matching CRC.
+// 1: first layout; 2: bypass mask, grains, freeze, vocoder, cross-synthesis,
+// phaser, flanger, rotary, hum, feedback, auto-tap and swell params.
+constexpr uint32_t STATE_VERSION = 2;
+constexpr uint32_t STATE_FORMAT = (STATE_VERSION << 16) | sizeof(ParamState);
+constexpr uint32_t AUTOSAVE_DELAY_MS = 3000;       // Save after this much inactivity
+
+struct StateRecord
+{
+    uint32_t magic;
+    uint32_t format;    // Layout changes invalidate old records
+    uint32_t seq;
+    ParamState state;
+    uint32_t crc;       // CRC32 of everything above
+};
+static_assert(sizeof(StateRecord) <= STATE_SLOT_BYTES, "state record must fit one slot");
+
+enum StoreStep { STORE_IDLE, STORE_ERASE, STORE_WRITE };
+
+StateRecord state_record;       // Record being written
+StoreStep store_step = STORE_IDLE;
+uint32_t state_seq = 0;         // Sequence number of the newest record in flash
+uint32_t state_next_slot = 0;
+bool state_dirty = false;
+uint32_t state_changed_ms = 0;
+
+void CaptureParamState(ParamState& st)
+{
+    st.ch1 = ch1_params;
+    st.ch2 = ch2_params;
+    st.cross_mod_amt = cross_mod_amt;
+    st.cross_bleed = cross_bleed;
+    st.stereo_width = stereo_width;
+    st.balance = balance;
+    st.reverb_mix = reverb_mix;
+    st.reverb_time = reverb_time;
+    st.master_gain = master_gain;
+    st.vocoder_release = vocoder_release;
+    st.xsynth_morph = xsynth_morph;
+    st.phaser_spread = phaser_spread;
+    st.phaser_stereo = phaser_stereo;
+    st.rotary_mix = rotary_mix;
+    st.rotary_mic_angle = rotary_mic_angle;
+    st.rotary_fast = rotary_fast;
+    st.hum_cancel = hum_cancel;
+    st.hum_harmonics = hum_harmonics;
+    st.feedback_detect = feedback_detect;
+    st.auto_tap = auto_tap;
+    st.routing_mode = routing_mode;
+}
+
+/**
+ * Apply a snapshot directly, without ramps: at boot before audio starts,
+ * or from the audio callback at a block boundary (scene recall)
+ */
+void LoadParamState(const ParamState& st)
+{
+    ch1_params = st.ch1;
+    ch2_params = st.ch2;
+    cross_mod_amt = st.cross_mod_amt;
+    cross_bleed = st.cross_bleed;
+    stereo_width = st.stereo_width;
+    balance = st.balance;
+    reverb_mix = st.reverb_mix;
+    reverb_time = st.reverb_time;
+    master_gain = st.master_gain;
+    vocoder_release = st.vocoder_release;
+    xsynth_morph = st.xsynth_morph;
+    phaser_spread = st.phaser_spread;
+    phaser_stereo = st.phaser_stereo != 0;
+    rotary_mix = st.rotary_mix;
+    rotary_mic_angle = st.rotary_mic_angle;
+    rotary_fast = st.rotary_fast != 0;
+    hum_cancel = st.hum_cancel != 0;
+    hum_harmonics = st.hum_harmonics;
+    feedback_detect = st.feedback_detect != 0;
+    auto_tap = st.auto_tap;
+    if(st.routing_mode < NUM_ROUTING_MODES)
+        routing_mode = (RoutingMode)st.routing_mode;
+    mix_matrix_dirty = true;
+}
+
+uint32_t Crc32(const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xFFFFFFFF;
+    while(size--)
+    {
+        crc ^= *p++;
+        for(int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+}
+
+inline uint32_t StateSlotOffset(uint32_t slot)
+{
+    return STATE_REGION_OFFSET + slot * STATE_SLOT_BYTES;
+}
+
+// A slot can be programmed without an erase only while it is all 0xFF
+bool StateSlotBlank(uint32_t slot)
+{
+    const uint32_t* w = static_cast<const uint32_t*>(hw.qspi.GetData(StateSlotOffset(slot)));
+    for(size_t i = 0; i < STATE_SLOT_BYTES / sizeof(uint32_t); i++)
+        if(w[i] != 0xFFFFFFFFu)
+            return false;
+    return true;
+}
+
+/**
+ * Restore the newest valid record from QSPI (memory-mapped read)
+ * Returns false if none was found and the defaults stay in place.
+ */
+bool LoadLastState()
+{
+    const StateRecord* best = nullptr;
+    uint32_t best_slot = 0;
+
+    for(uint32_t slot = 0; slot < STATE_SLOTS; slot++)
+    {
+        const StateRecord* r = static_cast<const StateRecord*>(hw.qspi.GetData(StateSlotOffset(slot)));
+        if(r->magic != STATE_MAGIC || r->format != STATE_FORMAT)
+            continue;
+        if(Crc32(r, offsetof(StateRecord, crc)) != r->crc)
+            continue;  // Torn write (power lost mid-save)
+        if(!best || r->seq > best->seq)
+        {
+            best = r;
+            best_slot = slot;
+        }
+    }
+
+    if(!best)
+        return false;
+
+    LoadParamState(best->state);
+    state_seq = best->seq;
+
+    // A save torn by power loss leaves its slot partly programmed: skip it.
+    // A sector start is always erased before its first write.
+    state_next_slot = (best_slot + 1) % STATE_SLOTS;
+    while(StateSlotOffset(state_next_slot) % STATE_SECTOR_BYTES != 0
+          && !StateSlotBlank(state_next_slot))
+        state_next_slot = (state_next_slot + 1) % STATE_SLOTS;
+    return true;
+}
+
+void MarkStateDirty()
+{
+    state_dirty = true;
+    state_changed_ms = System::GetNow();
+}
+
+/**
+ * Autosave step, one flash operation per call so the main loop keeps
+ * servicing commands between the erase and the page write. The audio
+ * callback never touches QSPI, so it is unaffected by flash busy time.
+ * Returns true while a save is in progress.
+ */
+bool ServiceStateStore()
+{
+    uint32_t addr = QSPI_BASE + StateSlotOffset(state_next_slot);
+
+    switch(store_step)
+    {
+        case STORE_IDLE:
+            if(!state_dirty || System::GetNow() - state_changed_ms < AUTOSAVE_DELAY_MS)
+                return false;
+            state_dirty = false;
+
+            state_record.magic = STATE_MAGIC;
+            state_record.format = STATE_FORMAT;
+            state_record.seq = state_seq + 1;
+            CaptureParamState(state_record.state);
+            state_record.crc = Crc32(&state_record, offsetof(StateRecord, crc));
+
+            // Entering a new sector: erase it first (it holds the oldest records)
+            store_step = (StateSlotOffset(state_next_slot) % STATE_SECTOR_BYTES == 0)
+                             ? STORE_ERASE : STORE_WRITE;
+            return true;
+
+        case STORE_ERASE:
+            hw.qspi.EraseSector(addr);
+            store_step = STORE_WRITE;
+            return true;
+
+        case STORE_WRITE:
+            hw.qspi.Write(addr, sizeof(state_record), reinterpret_cast<uint8_t*>(&state_record));
+            state_seq = state_record.seq;
+            state_next_slot = (state_next_slot + 1) % STATE_SLOTS;
+            store_step = STORE_IDLE;
+            return false;
+    }
+    return false;
+}
+
+// --- EXPRESSION PEDALS ---
+// Pedals on the ADC are read at control rate from the main loop. The
+// heel/toe range calibrates itself as the pedal is swept, the position is
+// smoothed and shaped by a curve table, and each target parameter gets its
+// own lo..hi range (lo > hi reverses the sweep). Values go through
+// ApplyParam, the same path as USB commands.
+constexpr size_t NUM_EXPRESSION = 2;
+constexpr size_t EXP_MAX_TARGETS = 4;
+constexpr size_t EXP_CURVE_POINTS = 65;
+constexpr float EXP_MIN_SPAN = 0.1f;           // Travel needed before a pedal is live
+constexpr float EXP_DEADZONE = 0.02f;          // Each end of travel that reads as heel/toe
+constexpr float EXP_SMOOTH = 0.05f;            // One-pole per audio block (~20 ms)
+constexpr float EXP_THRESHOLD = 1.0f / 1024.0f;  // Smaller moves are not applied
+
+enum ExpCurve { EXP_LINEAR = 0, EXP_LOG, EXP_SCURVE, NUM_EXP_CURVES };
+
+struct ExpTarget
+{
+    char name[32];
+    float lo;
+    float hi;
+};
+
+// Saved pedal assignment (lives in the scene bank)
+struct ExpMapping
+{
+    uint32_t curve;
+    uint32_t num_targets;
+    ExpTarget targets[EXP_MAX_TARGETS];
+};
+
+// Runtime pedal state
+struct ExpressionPedal
+{
+    float raw_min = 1.0f;    // Auto-calibrated heel/toe ADC readings
+    float raw_max = 0.0f;
+    float smoothed = 0.0f;
+    float applied = -1.0f;   // Last position sent to the targets (< 0 forces a send)
+};
+
+// Seed A0-A1 (pedal wiper, 3V3 across the track)
+const Pin EXPRESSION_PINS[NUM_EXPRESSION] = {seed::A0, seed::A1};
+
+ExpressionPedal pedals[NUM_EXPRESSION];
+float exp_curves[NUM_EXP_CURVES][EXP_CURVE_POINTS];
+
+// --- SCENES & FOOTSWITCHES ---
+// Scenes are full parameter snapshots. Footswitches are scanned by a timer
+// interrupt and debounced on the leading edge: the first scan that sees an
+// edge acts on it, then further bounce is ignored for the lockout. Scene
+// recall, rotary speed and freeze are single writes the audio callback picks
+// up, so the scan interrupt posts them itself. Worst case from contact to the
+// output for a scene is one scan (0.25 ms), up to one block (1 ms) waiting
+// for the boundary, and one block in the output DMA half-buffer (1 ms):
+// 2.25 ms, 1.75 ms on average, until the output starts its SCENE_DIP_SAMPLES
+// (1 ms) dip. The scene sounds one block later and fades in over 1 ms.
+// Bypass toggles post to the stage ramp
+// mailboxes, so they are left to the main loop; the new state lands at the
+// silent point of the dip, RAMP_SAMPLES (5 ms) later, and fades in over
+// another 5 ms.
+// The trace shows the split: TRACE_FOOTSWITCH at detection, then
+// TRACE_PRESET_LOAD or TRACE_BYPASS when the callback applies the change.
+//
+// Footswitch actions: 0 = none, 1..4 = recall scene, 11..14 = toggle
+// channel 1 drive/filter/delay/chorus bypass, 15 = toggle channel 1
+// freeze, 21..25 = same for channel 2, 30 = toggle rotary slow/fast.
+constexpr int FS_ROTARY_SPEED = 30;
+constexpr uint32_t SCENE_BANK_OFFSET = STATE_REGION_OFFSET - STATE_SECTOR_BYTES;  // Sector below the state log
+constexpr uint32_t SCENE_MAGIC = 0x4E435344;       // "DSCN"
+constexpr uint32_t SCENE_FORMAT = (STATE_VERSION << 16) | sizeof(ParamState);
+
+struct SceneBank
+{
+    uint32_t magic;
+    uint32_t format;
+    int32_t fs_action[NUM_FOOTSWITCHES];
+    ExpMapping exp_map[NUM_EXPRESSION];
+    ParamState scenes[NUM_SCENES];
+    uint32_t crc;       // CRC32 of everything above
+};
+static_assert(sizeof(SceneBank) <= STATE_SECTOR_BYTES, "scene bank must fit one sector");
+
+// Seed pins D7-D10, active low (switch to ground, internal pull-up)
+const Pin FOOTSWITCH_PINS[NUM_FOOTSWITCHES] = {seed::D7, seed::D8, seed::D9, seed::D10};
+
+struct Footswitch
+{
+    GPIO pin;
+    bool down = false;       // Debounced state
+    uint16_t lockout = 0;    // Scans left ignoring bounce after an edge
+};
+
+Footswitch footswitches[NUM_FOOTSWITCHES];
+TimerHandle footswitch_timer;
+uint32_t fs_pressed = 0;     // Bypass toggles waiting for the main loop (bit per footswitch)
+
+SceneBank scene_bank;
+StoreStep bank_step = STORE_IDLE;
+bool bank_dirty = false;
+uint32_t bank_changed_ms = 0;
+
+/**
+ * Ramp action: swap in a scene at the silent point of an output dip
+ * Every parameter changes at once, before the next block uses them.
+ */
+void ApplyScene(void*, int scene)
+{
+    RoutingMode prev_mode = routing_mode;
+    LoadParamState(scene_bank.scenes[scene]);
+    if(routing_mode != prev_mode)
+        SetRoutingMode(routing_mode);  // New topology from the next block
+
+    control_changed = true;
+    Trace(TRACE_PRESET_LOAD, scene);
+}
+
+/**
+ * Recall a scene behind a short dip of the whole output
+ * Mode, bypass and routing changes would click if swapped under signal.
+ * Safe from the footswitch scan interrupt.
+ */
+void RecallScene(int scene)
+{
+    output_ramp.Post(GainRamp::DIP, ApplyScene, nullptr, scene, SCENE_DIP_SAMPLES);
+}
+
+// Bypass toggles post to the same ramp mailboxes as USB commands, so only
+// the main loop may run them
+inline bool FootswitchDeferred(int action)
+{
+    int stage = action % 10 - 1;
+    return action > 10 && action != FS_ROTARY_SPEED && stage >= 0 && stage < NUM_CHANNEL_STAGES;
+}
+
+/**
+ * Run a footswitch's assigned action
+ * Called from the scan interrupt, or from the main loop for bypass toggles.
+ */
+void FootswitchPressed(size_t n)
+{
+    int action = scene_bank.fs_action[n];
+
+    if(action >= 1 && action <= (int)NUM_SCENES)
+    {
+        RecallScene(action - 1);
+    }
+    else if(action == FS_ROTARY_SPEED)
+    {
+        rotary_fast = !rotary_fast;
+        control_changed = true;
+    }
+    else if(action > 10)
+    {
+        int ch = action / 10 - 1;
+        int stage = action % 10 - 1;
+        if(ch > 1 || stage < 0)
+            return;
+        if(stage == NUM_CHANNEL_STAGES)
+        {
+            SetFreeze(ch, !freezes[ch].hold);
+            return;
+        }
+        if(stage > NUM_CHANNEL_STAGES)
+            return;
+        const ChannelParams& p = (ch == 0) ? ch1_params : ch2_params;
+        SetBypassRamped(ch, p.bypass ^ (1u << stage));
+        control_changed = true;
+    }
+}
+
+/**
+ * Timer interrupt: sample every footswitch and debounce
+ * A press acts at once, except bypass toggles, which are flagged for the
+ * main loop.
+ */
+void ScanFootswitches(void*)
+{
+    for(size_t n = 0; n < NUM_FOOTSWITCHES; n++)
+    {
+        Footswitch& fs = footswitches[n];
+        if(fs.lockout > 0)
+        {
+            fs.lockout--;
+            continue;
+        }
 
-// --- HARDWARE DECLARATION ---
-DaisySeed hw;
+        bool down = !fs.pin.Read();
+        if(down == fs.down)
+            continue;
 
-// --- EFFECTS MODULES ---
-// Channel 1 Effects
-Overdrive drive1;
-Svf filter1;
-DelayLine<float, MAX_DELAY_SAMPLES> del1;
-Chorus chorus1;
-
-// Channel 2 Effects
-Overdrive drive2;
-Svf filter2;
-DelayLine<float, MAX_DELAY_SAMPLES> del2;
-Chorus chorus2;
+        fs.down = down;
+        fs.lockout = FOOTSWITCH_LOCKOUT_SCANS;
+        if(down)
+        {
+            int action = scene_bank.fs_action[n];
+            Trace(TRACE_FOOTSWITCH, n, (float)action);
+            if(FootswitchDeferred(action))
+            {
+                __atomic_fetch_or(&fs_pressed, 1u << n, __ATOMIC_RELAXED);
+                SignalMain(EVENT_FOOTSWITCH);
+            }
+            else
+            {
+                FootswitchPressed(n);
+            }
+        }
+    }
+}
 
-// Shared/Master Effects (Reverb removed for compatibility)
-// ReverbSc reverb;
+void InitFootswitches()
+{
+    for(size_t n = 0; n < NUM_FOOTSWITCHES; n++)
+        footswitches[n].pin.Init(FOOTSWITCH_PINS[n], GPIO::Mode::INPUT, GPIO::Pull::PULLUP);
 
-// --- PARAMETERS ---
-// Channel 1
-float ch1_gain = 1.0f;
-float ch1_drive = 0.0f;
-float ch1_filter_freq = 10000.0f;
-float ch1_filter_res = 0.1f;
-float ch1_delay_time = 0.0f;
-float ch1_delay_feedback = 0.0f;
-float ch1_delay_mix = 0.0f;
-float ch1_chorus_depth = 0.0f;
-float ch1_chorus_rate = 0.5f;
-
-// Channel 2
-float ch2_gain = 1.0f;
-float ch2_drive = 0.0f;
-float ch2_filter_freq = 10000.0f;
-float ch2_filter_res = 0.1f;
-float ch2_delay_time = 0.0f;
-float ch2_delay_feedback = 0.0f;
-float ch2_delay_mix = 0.0f;
-float ch2_chorus_depth = 0.0f;
-float ch2_chorus_rate = 0.5f;
+    TimerHandle::Config cfg;
+    cfg.periph = TimerHandle::Config::Peripheral::TIM_5;
+    cfg.dir = TimerHandle::Config::CounterDir::UP;
+    cfg.enable_irq = true;
+    footswitch_timer.Init(cfg);
+    footswitch_timer.SetPeriod(footswitch_timer.GetFreq() / FOOTSWITCH_SCAN_HZ - 1);
+    footswitch_timer.SetCallback(ScanFootswitches);
+    footswitch_timer.Start();
+}
 
-// Cross-channel modulation
-float cross_mod_amt = 0.0f;      // Amount of cross-modulation
-float cross_bleed = 0.0f;        // How much channel 1 bleeds into channel 2 and vice versa
-float stereo_width = 1.0f;       // Stereo width control
+/**
+ * Restore scenes, footswitch and pedal assignments from QSPI
+ * Without a valid bank every scene starts as the current state.
+ */
+void LoadSceneBank()
+{
+    const SceneBank* b = static_cast<const SceneBank*>(hw.qspi.GetData(SCENE_BANK_OFFSET));
+    if(b->magic == SCENE_MAGIC && b->format == SCENE_FORMAT
+       && Crc32(b, offsetof(SceneBank, crc)) == b->crc)
+    {
+        scene_bank = *b;
+        return;
+    }
 
-// Master
-float reverb_mix = 0.0f;
-float reverb_time = 0.5f;
-float master_gain = 1.0f;
+    for(size_t n = 0; n < NUM_FOOTSWITCHES; n++)
+        scene_bank.fs_action[n] = (int32_t)(n < NUM_SCENES ? n + 1 : 0);
+    for(size_t k = 0; k < NUM_SCENES; k++)
+        CaptureParamState(scene_bank.scenes[k]);
+}
 
-// Filter types
-enum FilterMode { LOWPASS = 0, BANDPASS = 1, HIGHPASS = 2 };
-FilterMode ch1_filter_mode = LOWPASS;
-FilterMode ch2_filter_mode = LOWPASS;
+void MarkBankDirty()
+{
+    bank_dirty = true;
+    bank_changed_ms = System::GetNow();
+}
 
-// Serial buffer
-char serial_buf[128];
-int buf_pos = 0;
-volatile bool new_data_ready = false;
+/**
+ * Save the scene bank, one flash operation per call (see ServiceStateStore)
+ * The bank has its own sector and only changes on explicit edits.
+ */
+bool ServiceSceneStore()
+{
+    uint32_t addr = QSPI_BASE + SCENE_BANK_OFFSET;
+
+    switch(bank_step)
+    {
+        case STORE_IDLE:
+            if(!bank_dirty || System::GetNow() - bank_changed_ms < AUTOSAVE_DELAY_MS)
+                return false;
+            bank_dirty = false;
+            bank_step = STORE_ERASE;
+            return true;
+
+        case STORE_ERASE:
+            hw.qspi.EraseSector(addr);
+            bank_step = STORE_WRITE;
+            return true;
+
+        case STORE_WRITE:
+            scene_bank.magic = SCENE_MAGIC;
+            scene_bank.format = SCENE_FORMAT;
+            scene_bank.crc = Crc32(&scene_bank, offsetof(SceneBank, crc));
+            hw.qspi.Write(addr, sizeof(scene_bank), reinterpret_cast<uint8_t*>(&scene_bank));
+            bank_step = STORE_IDLE;
+            return false;
+    }
+    return false;
+}
 
 /**
- * Soft clipping function for musical saturation
- * Renamed to avoid conflict with DaisySP's SoftClip
+ * Apply one named parameter
+ * Shared by every control source (USB Serial, restored state, ...).
+ * Returns false if name is not a parameter.
  */
-inline float MySoftClip(float x)
+bool ApplyParam(const char* name, float val)
 {
-    if (x > 1.0f) return 1.0f;
-    if (x < -1.0f) return -1.0f;
-    return x - (x * x * x) / 3.0f;
+    // Channel 1 parameters
+    if(strcmp(name, "ch1_gain") == 0)           ch1_params.gain = fclamp(val, 0.0f, 2.0f);
+    else if(strcmp(name, "ch1_drive") == 0)     ch1_params.drive = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_filter_freq") == 0) ch1_params.filter_freq = fclamp(val, 20.0f, 20000.0f);
+    else if(strcmp(name, "ch1_filter_res") == 0)  ch1_params.filter_res = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_delay_time") == 0)  ch1_params.delay_time = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_delay_fb") == 0)    ch1_params.delay_feedback = fclamp(val, 0.0f, 0.95f);
+    else if(strcmp(name, "ch1_delay_mix") == 0)   ch1_params.delay_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_chorus_depth") == 0) ch1_params.chorus_depth = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_chorus_rate") == 0)  ch1_params.chorus_rate = fclamp(val, 0.01f, 10.0f);
+    else if(strcmp(name, "ch1_chorus_mode") == 0) {
+        int mode = (int)val;
+        if(mode >= 0 && mode <= 1 && mode != ch1_params.chorus_mode)
+            SetChorusModeRamped(0, (ModMode)mode);
+    }
+    else if(strcmp(name, "ch1_flanger_fb") == 0) ch1_params.flanger_feedback = fclamp(val, -0.95f, 0.95f);
+    else if(strcmp(name, "ch1_pan") == 0)          ch1_params.pan = fclamp(val, -1.0f, 1.0f);
+    else if(strcmp(name, "ch1_filter_mode") == 0) {
+        int mode = (int)val;
+        if(mode >= 0 && mode <= 2 && mode != ch1_params.filter_mode)
+            SetFilterModeRamped(0, (FilterMode)mode);
+    }
+    else if(strcmp(name, "ch1_bypass") == 0)     SetBypassRamped(0, (uint32_t)fclamp(val, 0.0f, 15.0f));
+    else if(strcmp(name, "ch1_freeze_mix") == 0) ch1_params.freeze_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_grain_mix") == 0)  ch1_params.grain_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_grain_pos") == 0)  ch1_params.grain_pos = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_grain_size") == 0) ch1_params.grain_size = fclamp(val, 0.01f, 0.5f);
+    else if(strcmp(name, "ch1_grain_density") == 0) ch1_params.grain_density = fclamp(val, 0.5f, 100.0f);
+    else if(strcmp(name, "ch1_grain_pitch") == 0) ch1_params.grain_pitch = fclamp(val, -24.0f, 24.0f);
+    else if(strcmp(name, "ch1_grain_spray") == 0) ch1_params.grain_spray = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_swell") == 0)      ch1_params.swell_time = fclamp(val, 0.0f, 4.0f);
+    else if(strcmp(name, "ch1_phaser_mix") == 0)  ch1_params.phaser_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_phaser_rate") == 0) ch1_params.phaser_rate = fclamp(val, 0.05f, 5.0f);
+    else if(strcmp(name, "ch1_phaser_depth") == 0) ch1_params.phaser_depth = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch1_phaser_stages") == 0) {
+        int n = (int)val;
+        if(n == 4 || n == 8 || n == 12)
+            ch1_params.phaser_stages = n;
+    }
+
+    // Channel 2 parameters
+    else if(strcmp(name, "ch2_gain") == 0)           ch2_params.gain = fclamp(val, 0.0f, 2.0f);
+    else if(strcmp(name, "ch2_drive") == 0)          ch2_params.drive = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_filter_freq") == 0)    ch2_params.filter_freq = fclamp(val, 20.0f, 20000.0f);
+    else if(strcmp(name, "ch2_filter_res") == 0)     ch2_params.filter_res = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_delay_time") == 0)     ch2_params.delay_time = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_delay_fb") == 0)       ch2_params.delay_feedback = fclamp(val, 0.0f, 0.95f);
+    else if(strcmp(name, "ch2_delay_mix") == 0)      ch2_params.delay_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_chorus_depth") == 0)   ch2_params.chorus_depth = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_chorus_rate") == 0)    ch2_params.chorus_rate = fclamp(val, 0.01f, 10.0f);
+    else if(strcmp(name, "ch2_chorus_mode") == 0) {
+        int mode = (int)val;
+        if(mode >= 0 && mode <= 1 && mode != ch2_params.chorus_mode)
+            SetChorusModeRamped(1, (ModMode)mode);
+    }
+    else if(strcmp(name, "ch2_flanger_fb") == 0) ch2_params.flanger_feedback = fclamp(val, -0.95f, 0.95f);
+    else if(strcmp(name, "ch2_pan") == 0)            ch2_params.pan = fclamp(val, -1.0f, 1.0f);
+    else if(strcmp(name, "ch2_filter_mode") == 0) {
+        int mode = (int)val;
+        if(mode >= 0 && mode <= 2 && mode != ch2_params.filter_mode)
+            SetFilterModeRamped(1, (FilterMode)mode);
+    }
+    else if(strcmp(name, "ch2_bypass") == 0)     SetBypassRamped(1, (uint32_t)fclamp(val, 0.0f, 15.0f));
+    else if(strcmp(name, "ch2_freeze_mix") == 0) ch2_params.freeze_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_grain_mix") == 0)  ch2_params.grain_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_grain_pos") == 0)  ch2_params.grain_pos = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_grain_size") == 0) ch2_params.grain_size = fclamp(val, 0.01f, 0.5f);
+    else if(strcmp(name, "ch2_grain_density") == 0) ch2_params.grain_density = fclamp(val, 0.5f, 100.0f);
+    else if(strcmp(name, "ch2_grain_pitch") == 0) ch2_params.grain_pitch = fclamp(val, -24.0f, 24.0f);
+    else if(strcmp(name, "ch2_grain_spray") == 0) ch2_params.grain_spray = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_swell") == 0)      ch2_params.swell_time = fclamp(val, 0.0f, 4.0f);
+    else if(strcmp(name, "ch2_phaser_mix") == 0)  ch2_params.phaser_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_phaser_rate") == 0) ch2_params.phaser_rate = fclamp(val, 0.05f, 5.0f);
+    else if(strcmp(name, "ch2_phaser_depth") == 0) ch2_params.phaser_depth = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "ch2_phaser_stages") == 0) {
+        int n = (int)val;
+        if(n == 4 || n == 8 || n == 12)
+            ch2_params.phaser_stages = n;
+    }
+
+    // Cross-channel and master
+    else if(strcmp(name, "cross_mod") == 0)      cross_mod_amt = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "cross_bleed") == 0)    cross_bleed = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "stereo_width") == 0)   stereo_width = fclamp(val, 0.0f, 2.0f);
+    else if(strcmp(name, "balance") == 0)        balance = fclamp(val, -1.0f, 1.0f);
+    else if(strcmp(name, "reverb_mix") == 0)     reverb_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "reverb_time") == 0)    reverb_time = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "master_gain") == 0)    master_gain = fclamp(val, 0.0f, 2.0f);
+    else if(strcmp(name, "vocoder_release") == 0) vocoder_release = fclamp(val, 0.01f, 0.5f);
+    else if(strcmp(name, "xsynth_morph") == 0)   xsynth_morph = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "auto_tap") == 0)       auto_tap = (uint32_t)fclamp(val, 0.0f, 2.0f);
+    else if(strcmp(name, "feedback_detect") == 0) feedback_detect = val >= 0.5f;
+    else if(strcmp(name, "hum_cancel") == 0)     hum_cancel = val >= 0.5f;
+    else if(strcmp(name, "hum_harmonics") == 0)  hum_harmonics = (uint32_t)fclamp(val, 1.0f, (float)MAX_HUM_HARMONICS);
+    else if(strcmp(name, "rotary_mix") == 0)     rotary_mix = fclamp(val, 0.0f, 1.0f);
+    else if(strcmp(name, "rotary_fast") == 0)    rotary_fast = val >= 0.5f;
+    else if(strcmp(name, "rotary_mic_angle") == 0) rotary_mic_angle = fclamp(val, 0.0f, 180.0f);
+    else if(strcmp(name, "phaser_stereo") == 0)  phaser_stereo = val >= 0.5f;
+    else if(strcmp(name, "phaser_spread") == 0)  phaser_spread = fclamp(val, 0.0f, 180.0f);
+    else if(strcmp(name, "routing_mode") == 0) {
+        int mode = (int)val;
+        if(mode >= 0 && mode < NUM_ROUTING_MODES && mode != routing_mode)
+            SetRoutingModeRamped((RoutingMode)mode);
+    }
+    else return false;
+
+    // Reverb parameters (disabled for now)
+    // reverb.SetFeedback(reverb_time);
+    // reverb.SetLpFreq(REVERB_LP_FREQ);
+
+    // Routing/gain params are folded into the mix matrix
+    mix_matrix_dirty = true;
+    return true;
 }
 
 /**
- * Audio Callback - Dual Channel Processing
- *
- * SIGNAL FLOW PER CHANNEL:
- * Guitar In → Gain → Drive → Filter → Delay → Chorus → Reverb → Out
- *
- * CROSS-CHANNEL:
- * - Channel 1 can modulate Channel 2 filter frequency
- * - Channel 2 can modulate Channel 1 filter frequency
- * - Cross-bleed mixes channels together
+ * Build the curve tables and start ADC conversion for the pedals
  */
-void AudioCallback(AudioHandle::InputBuffer in, AudioHandle::OutputBuffer out, size_t size)
+void InitExpression()
 {
-    for(size_t i = 0; i < size; i++)
+    for(size_t k = 0; k < EXP_CURVE_POINTS; k++)
     {
-        // ========== READ INPUTS ==========
-        float ch1_in = in[0][i];
-        float ch2_in = in[1][i];
+        float x = (float)k / (EXP_CURVE_POINTS - 1);
+        exp_curves[EXP_LINEAR][k] = x;
+        exp_curves[EXP_LOG][k] = (powf(10.0f, 2.0f * x) - 1.0f) / 99.0f;  // Audio taper (40 dB)
+        exp_curves[EXP_SCURVE][k] = x * x * (3.0f - 2.0f * x);
+    }
 
-        // Validate inputs (protect against NaN/Inf)
-        if(!std::isfinite(ch1_in)) ch1_in = 0.0f;
-        if(!std::isfinite(ch2_in)) ch2_in = 0.0f;
+    AdcChannelConfig cfg[NUM_EXPRESSION];
+    for(size_t n = 0; n < NUM_EXPRESSION; n++)
+        cfg[n].InitSingle(EXPRESSION_PINS[n]);
+    hw.adc.Init(cfg, NUM_EXPRESSION);
+    hw.adc.Start();
+}
 
-        // ========== CHANNEL 1 PROCESSING ==========
+inline float ExpCurveLookup(uint32_t curve, float x)
+{
+    const float* t = exp_curves[curve < NUM_EXP_CURVES ? curve : (uint32_t)EXP_LINEAR];
+    float pos = x * (EXP_CURVE_POINTS - 1);
+    size_t i = (size_t)pos;
+    if(i >= EXP_CURVE_POINTS - 1)
+        return t[EXP_CURVE_POINTS - 1];
+    return t[i] + (t[i + 1] - t[i]) * (pos - i);
+}
 
-        // Input gain
-        float ch1 = ch1_in * ch1_gain;
+/**
+ * Read, calibrate and smooth each pedal and push moves to its targets
+ * (main loop, once per pass)
+ */
+void ServiceExpression()
+{
+    for(size_t n = 0; n < NUM_EXPRESSION; n++)
+    {
+        ExpressionPedal& e = pedals[n];
+        ExpMapping& m = scene_bank.exp_map[n];
 
-        // Overdrive
-        drive1.SetDrive(ch1_drive);
-        ch1 = drive1.Process(ch1);
+        // The calibrated range only widens as the pedal is swept
+        float raw = hw.adc.GetFloat(n);
+        if(raw < e.raw_min) e.raw_min = raw;
+        if(raw > e.raw_max) e.raw_max = raw;
+        float span = e.raw_max - e.raw_min;
+        if(span < EXP_MIN_SPAN || m.num_targets == 0)
+            continue;
 
-        // Filter with cross-modulation from channel 2
-        float ch1_mod_freq = ch1_filter_freq;
-        if (cross_mod_amt > 0.0f) {
-            ch1_mod_freq += (ch2_in * cross_mod_amt * CROSS_MOD_FREQ_RANGE);
-            ch1_mod_freq = fclamp(ch1_mod_freq, 20.0f, 20000.0f);
-        }
-        filter1.SetFreq(ch1_mod_freq);
-        filter1.SetRes(ch1_filter_res);
-        filter1.Process(ch1);
+        float x = (raw - e.raw_min - EXP_DEADZONE * span) / (span * (1.0f - 2.0f * EXP_DEADZONE));
+        e.smoothed += (fclamp(x, 0.0f, 1.0f) - e.smoothed) * EXP_SMOOTH;
+        if(fabsf(e.smoothed - e.applied) < EXP_THRESHOLD)
+            continue;
+        e.applied = e.smoothed;
 
-        // Select filter output based on mode
-        switch(ch1_filter_mode) {
-            case LOWPASS:  ch1 = filter1.Low();  break;
-            case BANDPASS: ch1 = filter1.Band(); break;
-            case HIGHPASS: ch1 = filter1.High(); break;
+        float y = ExpCurveLookup(m.curve, e.smoothed);
+        for(size_t t = 0; t < m.num_targets;)
+        {
+            ExpTarget& tg = m.targets[t];
+            float val = tg.lo + (tg.hi - tg.lo) * y;
+            if(ApplyParam(tg.name, val))
+            {
+                // Same event as a serial write, so pedal moves show in traces
+                Trace(TRACE_PARAM, ParamHash(tg.name), val);
+                t++;
+                continue;
+            }
+            // Not a parameter: drop the target
+            m.num_targets--;
+            memmove(&m.targets[t], &m.targets[t + 1], (m.num_targets - t) * sizeof(ExpTarget));
         }
+        MarkStateDirty();
+    }
+}
 
-        // Delay
-        if (ch1_delay_mix > 0.0f) {
-            size_t delay_samples = static_cast<size_t>(ch1_delay_time * 48000.0f);
-            float delayed = del1.Read(delay_samples);
-            del1.Write(ch1 + (delayed * ch1_delay_feedback));
-            ch1 = ch1 * (1.0f - ch1_delay_mix) + delayed * ch1_delay_mix;
-        } else {
-            del1.Write(ch1);
-        }
+/**
+ * Pedal command, name without the "expN_" prefix:
+ *   curve:<0-2>  calibrate:1  clear:1  lo.<param>:<v>  hi.<param>:<v>
+ * Setting lo or hi of a new target adds it with lo = hi = v.
+ */
+bool ExpressionCommand(size_t n, const char* cmd, float val)
+{
+    ExpMapping& m = scene_bank.exp_map[n];
+    ExpressionPedal& e = pedals[n];
 
-        // Chorus
-        if (ch1_chorus_depth > 0.0f) {
-            chorus1.SetLfoDepth(ch1_chorus_depth);
-            chorus1.SetLfoFreq(ch1_chorus_rate);
-            ch1 = chorus1.Process(ch1);
-        }
+    if(strcmp(cmd, "curve") == 0) {
+        int c = (int)val;
+        if(c >= 0 && c < NUM_EXP_CURVES)
+            m.curve = c;
+    }
+    else if(strcmp(cmd, "calibrate") == 0) {
+        e.raw_min = 1.0f;
+        e.raw_max = 0.0f;
+        return true;
+    }
+    else if(strcmp(cmd, "clear") == 0) {
+        m.num_targets = 0;
+    }
+    else if(strncmp(cmd, "lo.", 3) == 0 || strncmp(cmd, "hi.", 3) == 0) {
+        const char* param = cmd + 3;
+        if(strlen(param) >= sizeof(m.targets[0].name))
+            return false;
 
-        // ========== CHANNEL 2 PROCESSING ==========
+        size_t t = 0;
+        while(t < m.num_targets && strcmp(m.targets[t].name, param) != 0)
+            t++;
+        if(t == m.num_targets)
+        {
+            if(m.num_targets >= EXP_MAX_TARGETS)
+                return false;
+            strcpy(m.targets[t].name, param);
+            m.targets[t].lo = val;
+            m.targets[t].hi = val;
+            m.num_targets++;
+        }
+        if(cmd[0] == 'l')
+            m.targets[t].lo = val;
+        else
+            m.targets[t].hi = val;
+    }
+    else return false;
 
-        // Input gain
-        float ch2 = ch2_in * ch2_gain;
+    e.applied = -1.0f;  // Re-send with the new mapping
+    MarkBankDirty();
+    return true;
+}
 
-        // Overdrive
-        drive2.SetDrive(ch2_drive);
-        ch2 = drive2.Process(ch2);
+// Cut filter (RBJ peaking EQ with negative gain)
+NotchCoefs FeedbackNotch(float hz, float db)
+{
+    float a = powf(10.0f, db / 40.0f);
+    float w0 = TWOPI_F * hz / SAMPLE_RATE;
+    float alpha = sinf(w0) / (2.0f * FBD_NOTCH_Q);
+    float cw = cosf(w0);
+    float a0 = 1.0f + alpha / a;
+    NotchCoefs q;
+    q.b0 = (1.0f + alpha * a) / a0;
+    q.b1 = -2.0f * cw / a0;
+    q.b2 = (1.0f - alpha * a) / a0;
+    q.a1 = q.b1;
+    q.a2 = (1.0f - alpha / a) / a0;
+    return q;
+}
 
-        // Filter with cross-modulation from channel 1
-        float ch2_mod_freq = ch2_filter_freq;
-        if (cross_mod_amt > 0.0f) {
-            ch2_mod_freq += (ch1_in * cross_mod_amt * CROSS_MOD_FREQ_RANGE);
-            ch2_mod_freq = fclamp(ch2_mod_freq, 20.0f, 20000.0f);
-        }
-        filter2.SetFreq(ch2_mod_freq);
-        filter2.SetRes(ch2_filter_res);
-        filter2.Process(ch2);
+/**
+ * Put a cut at hz: deepen an existing notch close by, else take a free
+ * slot (or the oldest one once all are in use)
+ */
+void DeployFeedbackNotch(float hz)
+{
+    FeedbackDetector& fd = feedback;
+    size_t slot = MAX_FEEDBACK_NOTCHES;
+    for(size_t k = 0; k < MAX_FEEDBACK_NOTCHES; k++)
+    {
+        float r = hz / fd.notch_hz[k];
+        if((notch_pending_active & (1u << k)) && r < FBD_SAME_NOTCH && r > 1.0f / FBD_SAME_NOTCH)
+            slot = k;
+    }
 
-        // Select filter output based on mode
-        switch(ch2_filter_mode) {
-            case LOWPASS:  ch2 = filter2.Low();  break;
-            case BANDPASS: ch2 = filter2.Band(); break;
-            case HIGHPASS: ch2 = filter2.High(); break;
-        }
+    notch_pending_reset = 0;
+    if(slot < MAX_FEEDBACK_NOTCHES)
+    {
+        fd.notch_db[slot] = fmaxf(fd.notch_db[slot] + FBD_DEEPEN_DB, FBD_MAX_CUT_DB);
+    }
+    else
+    {
+        slot = fd.next_slot;
+        for(size_t k = 0; k < MAX_FEEDBACK_NOTCHES; k++)
+            if(!(notch_pending_active & (1u << k)))
+            {
+                slot = k;
+                break;
+            }
+        if(slot == fd.next_slot)
+            fd.next_slot = (fd.next_slot + 1) % MAX_FEEDBACK_NOTCHES;
+        fd.notch_hz[slot] = hz;
+        fd.notch_db[slot] = FBD_NOTCH_DB;
+        notch_pending_reset = 1u << slot;
+    }
 
-        // Delay
-        if (ch2_delay_mix > 0.0f) {
-            size_t delay_samples = static_cast<size_t>(ch2_delay_time * 48000.0f);
-            float delayed = del2.Read(delay_samples);
-            del2.Write(ch2 + (delayed * ch2_delay_feedback));
-            ch2 = ch2 * (1.0f - ch2_delay_mix) + delayed * ch2_delay_mix;
-        } else {
-            del2.Write(ch2);
-        }
+    notch_pending[slot] = FeedbackNotch(fd.notch_hz[slot], fd.notch_db[slot]);
+    notch_pending_active |= 1u << slot;
+    notch_update = true;
+    Trace(TRACE_FEEDBACK, slot, fd.notch_hz[slot]);
+}
 
-        // Chorus
-        if (ch2_chorus_depth > 0.0f) {
-            chorus2.SetLfoDepth(ch2_chorus_depth);
-            chorus2.SetLfoFreq(ch2_chorus_rate);
-            ch2 = chorus2.Process(ch2);
-        }
+void ClearFeedbackNotches()
+{
+    notch_pending_active = 0;
+    notch_pending_reset = 0;
+    feedback.next_slot = 0;
+    notch_update = true;
+}
 
-        // ========== CROSS-CHANNEL BLEED ==========
-        if (cross_bleed > 0.0f) {
-            float temp_ch1 = ch1;
-            float temp_ch2 = ch2;
-            ch1 = ch1 * (1.0f - cross_bleed) + temp_ch2 * cross_bleed;
-            ch2 = ch2 * (1.0f - cross_bleed) + temp_ch1 * cross_bleed;
-        }
+/**
+ * Analyse one hop of the output for howl (main loop)
+ *
+ * Howl is a single sine that sits in one bin and does not go away: loud,
+ * well above the average bin, much higher than the bins beside it, with no
+ * strong partial at twice its frequency (a played note has one), and in
+ * the same bin for FBD_PERSIST_FRAMES analyses in a row.
+ */
+void ServiceFeedback()
+{
+    FeedbackDetector& fd = feedback;
+    if(!feedback_detect)
+    {
+        fd.read_pos = feedback_write_pos;
+        fd.candidate_frames = 0;
+        return;
+    }
+    uint32_t w = feedback_write_pos;
+    if(notch_update || w - fd.read_pos < FBD_FFT)
+        return;
+    if(w - fd.read_pos > FBD_RING - FBD_HOP)
+        fd.read_pos = w - FBD_FFT;   // Fell behind: skip to the newest frame
+    uint32_t start = fd.read_pos;
+    fd.read_pos += FBD_HOP;
 
-        // ========== STEREO WIDTH ==========
-        // Mid-side processing for stereo width control
-        float mid = (ch1 + ch2) * 0.5f;
-        float side = (ch1 - ch2) * 0.5f * stereo_width;
-        ch1 = mid + side;
-        ch2 = mid - side;
+    for(size_t j = 0; j < FBD_FFT; j++)
+        fd.frame[j] = fd.ring[(start + j) & (FBD_RING - 1)] * fd.window[j];
+    arm_rfft_fast_f32(&fd.fft, fd.frame, fd.spectrum, 0);
 
-        // ========== MASTER REVERB ==========
-        // Simple reverb placeholder (full reverb removed for compatibility)
-        // Can be added back with proper DaisySP reverb class
-        if (reverb_mix > 0.0f) {
-            // Simple feedback delay as reverb substitute
-            float reverb_l = ch1 * reverb_mix * reverb_time;
-            float reverb_r = ch2 * reverb_mix * reverb_time;
-            ch1 = ch1 * (1.0f - reverb_mix) + reverb_l;
-            ch2 = ch2 * (1.0f - reverb_mix) + reverb_r;
-        }
+    constexpr size_t bins = FBD_FFT / 2 + 1;
+    SpectrumMagnitudes(fd.spectrum, fd.mag_db, FBD_FFT);
+    float mean = 0.0f;
+    for(size_t k = 0; k < bins; k++)
+    {
+        mean += fd.mag_db[k] * fd.mag_db[k];
+        // Full-scale sine through the Hann window peaks at FBD_FFT / 4
+        fd.mag_db[k] = 20.0f * log10f(fd.mag_db[k] * (4.0f / FBD_FFT) + 1e-9f);
+    }
+    float mean_db = 10.0f * log10f(mean / bins * (16.0f / (FBD_FFT * FBD_FFT)) + 1e-18f);
 
-        // ========== MASTER OUTPUT ==========
-        ch1 = MySoftClip(ch1 * master_gain);
-        ch2 = MySoftClip(ch2 * master_gain);
+    if(fd.holdoff > 0)
+    {
+        fd.holdoff--;
+        return;
+    }
 
-        // Final safety check
-        if(!std::isfinite(ch1)) ch1 = 0.0f;
-        if(!std::isfinite(ch2)) ch2 = 0.0f;
+    // Strongest howl-like peak in this frame
+    size_t best = 0;
+    for(size_t k = 3; k < bins - 3; k++)
+    {
+        float m = fd.mag_db[k];
+        if(m < FBD_MIN_DB || m - mean_db < FBD_ABOVE_MEAN_DB)
+            continue;
+        if(m < fd.mag_db[k - 1] || m < fd.mag_db[k + 1])
+            continue;
+        float side = fmaxf(fmaxf(fd.mag_db[k - 2], fd.mag_db[k - 3]),
+                           fmaxf(fd.mag_db[k + 2], fd.mag_db[k + 3]));
+        if(m - side < FBD_NARROW_DB)
+            continue;
+        size_t h = 2 * k;
+        if(h + 1 < bins
+           && fmaxf(fmaxf(fd.mag_db[h - 1], fd.mag_db[h]), fd.mag_db[h + 1]) > m - FBD_HARMONIC_DB)
+            continue;
+        if(best == 0 || m > fd.mag_db[best])
+            best = k;
+    }
 
-        out[0][i] = ch1;
-        out[1][i] = ch2;
+    if(best == 0)
+    {
+        fd.candidate_frames = 0;
+        return;
     }
+    if(fd.candidate_frames > 0 && (best + 1 == fd.candidate_bin || best == fd.candidate_bin
+                                   || best == fd.candidate_bin + 1))
+        fd.candidate_frames++;
+    else
+        fd.candidate_frames = 1;
+    fd.candidate_bin = best;
+    if(fd.candidate_frames < FBD_PERSIST_FRAMES)
+        return;
+
+    // Parabolic interpolation between bins for the notch frequency
+    float a = fd.mag_db[best - 1], b = fd.mag_db[best], c = fd.mag_db[best + 1];
+    float offset = 0.5f * (a - c) / (a - 2.0f * b + c);
+    DeployFeedbackNotch((best + offset) * SAMPLE_RATE / FBD_FFT);
+    fd.candidate_frames = 0;
+    fd.holdoff = FBD_HOLDOFF_FRAMES;
+}
+
+void SendFeedbackReport()
+{
+    char line[256];
+    int n = snprintf(line, sizeof(line), "feedback:active=%lu", (unsigned long)notch_pending_active);
+    for(size_t k = 0; k < MAX_FEEDBACK_NOTCHES && n < (int)sizeof(line); k++)
+        if(notch_pending_active & (1u << k))
+            n += snprintf(line + n, sizeof(line) - n, ",n%u_hz=%d,n%u_db=%d", (unsigned)k + 1,
+                          (int)feedback.notch_hz[k], (unsigned)k + 1, (int)feedback.notch_db[k]);
+    SendLine(line);
 }
 
+// --- AUTO-TAP ---
+// Beat from the spacing of onsets on one channel: the median of the last
+// TAP_HISTORY intervals, used once most of them agree with it. The delay
+// time of both channels is set to one beat through ApplyParam.
+constexpr size_t TAP_HISTORY = 8;
+constexpr uint32_t TAP_MIN_AGREE = 4;           // Intervals within TAP_TOLERANCE of the median
+constexpr float TAP_TOLERANCE = 0.08f;
+constexpr float TAP_MIN_S = 0.25f;              // 240 BPM
+constexpr float TAP_MAX_S = 1.0f;               // 60 BPM (longest delay)
+constexpr float TAP_RESEND = 0.02f;             // Only update the delay on a 2% change
+
+struct AutoTap
+{
+    float intervals[TAP_HISTORY] = {};
+    size_t num = 0;
+    size_t next = 0;
+    uint32_t last_sample = 0;
+    bool have_last = false;
+    float beat = 0.0f;          // Seconds, 0 until found
+};
+
+AutoTap tap;
+
 /**
- * USB Receive Callback - Called when data arrives via USB Serial
+ * Drain the onset queue and follow the beat (main loop)
  */
-void UsbCallback(uint8_t* buf, uint32_t* len)
+void ServiceOnsets()
 {
-    for(uint32_t i = 0; i < *len; i++)
+    while(onset_tail != onset_head)
     {
-        char c = buf[i];
+        OnsetEvent e = onset_queue[onset_tail & (ONSET_QUEUE_SIZE - 1)];
+        onset_tail = onset_tail + 1;
+        if(auto_tap != e.channel + 1)
+            continue;
+
+        float dt = (e.sample - tap.last_sample) / SAMPLE_RATE;
+        bool counted = tap.have_last;
+        tap.last_sample = e.sample;
+        tap.have_last = true;
+        if(!counted || dt < TAP_MIN_S * (1.0f - TAP_TOLERANCE) || dt > TAP_MAX_S * (1.0f + TAP_TOLERANCE))
+            continue;
+
+        tap.intervals[tap.next] = dt;
+        tap.next = (tap.next + 1) % TAP_HISTORY;
+        if(tap.num < TAP_HISTORY)
+            tap.num++;
 
-        if(c == '\n' || c == ';')
+        // Median by insertion sort (at most 8 values)
+        float sorted[TAP_HISTORY];
+        for(size_t k = 0; k < tap.num; k++)
         {
-            serial_buf[buf_pos] = '\0';
-            new_data_ready = true;
-            buf_pos = 0;
+            size_t j = k;
+            for(; j > 0 && sorted[j - 1] > tap.intervals[k]; j--)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = tap.intervals[k];
+        }
+        float median = sorted[tap.num / 2];
+        uint32_t agree = 0;
+        for(size_t k = 0; k < tap.num; k++)
+            agree += fabsf(tap.intervals[k] - median) <= TAP_TOLERANCE * median;
+        if(agree < TAP_MIN_AGREE)
+            continue;
+
+        float beat = fclamp(median, TAP_MIN_S, TAP_MAX_S);
+        if(fabsf(beat - tap.beat) > TAP_RESEND * beat)
+        {
+            tap.beat = beat;
+            ApplyParam("ch1_delay_time", beat);
+            ApplyParam("ch2_delay_time", beat);
+            MarkStateDirty();
         }
+    }
+}
+
+void SendTempoReport()
+{
+    char line[128];
+    snprintf(line, sizeof(line), "tempo:bpm_x10=%lu,onsets1=%lu,onsets2=%lu,dropped=%lu",
+             (unsigned long)(tap.beat > 0.0f ? 600.0f / tap.beat : 0.0f),
+             (unsigned long)onsets[0].count, (unsigned long)onsets[1].count,
+             (unsigned long)onsets_dropped);
+    SendLine(line);
+}
+
+/**
+ * Run a control or report command (not part of the saved state)
+ * Returns false if name is not a command.
+ */
+bool HandleCommand(const char* name, float val)
+{
+    if(strcmp(name, "mute") == 0) {
+        output_muted = val >= 0.5f;
+        output_ramp.Post(output_muted ? GainRamp::FADE_OUT : GainRamp::FADE_IN);
+    }
+
+    else if(strcmp(name, "ch1_freeze") == 0)    SetFreeze(0, val >= 0.5f);
+    else if(strcmp(name, "ch2_freeze") == 0)    SetFreeze(1, val >= 0.5f);
+    else if(strcmp(name, "feedback_clear") == 0) ClearFeedbackNotches();
+
+    // Scope (tap and window apply at the next scope_arm)
+    else if(strcmp(name, "scope_tap") == 0) {
+        if(val >= 1.0f && val < (float)NUM_SCOPE_TAPS)
+            scope.tap = (uint32_t)val;
+    }
+    else if(strcmp(name, "scope_len") == 0) {
+        scope.len = (uint32_t)fclamp(val, SCOPE_MIN_SAMPLES, SCOPE_MAX_SAMPLES);
+    }
+    else if(strcmp(name, "scope_level") == 0)   scope.level = fclamp(val, -1.0f, 1.0f);
+    else if(strcmp(name, "scope_edge") == 0)    scope.falling = val >= 0.5f;
+    else if(strcmp(name, "scope_arm") == 0) {
+        if(val >= 0.5f)
+            ArmScope();
         else
+            CancelScope();
+    }
+
+    // Scenes (1-based) and footswitch assignments
+    else if(strcmp(name, "scene_recall") == 0) {
+        int k = (int)val - 1;
+        if(k >= 0 && k < (int)NUM_SCENES)
+            RecallScene(k);
+    }
+    else if(strcmp(name, "scene_save") == 0) {
+        int k = (int)val - 1;
+        if(k >= 0 && k < (int)NUM_SCENES)
         {
-            if(buf_pos < 127)
-            {
-                serial_buf[buf_pos++] = c;
-            }
-            else
-            {
-                // Buffer overflow protection - reset on overflow
-                buf_pos = 0;
-            }
+            CaptureParamState(scene_bank.scenes[k]);
+            MarkBankDirty();
         }
     }
+    else if(strncmp(name, "fs", 2) == 0 && name[2] >= '1' && name[2] < '1' + (int)NUM_FOOTSWITCHES
+            && strcmp(name + 3, "_action") == 0) {
+        scene_bank.fs_action[name[2] - '1'] = (int32_t)val;
+        MarkBankDirty();
+    }
+    else if(strncmp(name, "exp", 3) == 0 && name[3] >= '1' && name[3] < '1' + (int)NUM_EXPRESSION
+            && name[4] == '_') {
+        return ExpressionCommand(name[3] - '1', name + 5, val);
+    }
+
+    // Reports (value ignored)
+    else if(strcmp(name, "boot_report") == 0)    SendBootReport();
+    else if(strcmp(name, "fault_report") == 0)   SendFaultReport();
+    else if(strcmp(name, "hum_report") == 0)     SendHumReport();
+    else if(strcmp(name, "latency_report") == 0) SendLatencyReport();
+    else if(strcmp(name, "sched_report") == 0)   SendSchedReport((int)val);
+    else if(strcmp(name, "tempo_report") == 0)   SendTempoReport();
+    else if(strcmp(name, "feedback_report") == 0) SendFeedbackReport();
+    else if(strcmp(name, "prof_dump") == 0)      SendProfileDump();
+    else if(strcmp(name, "trace_dump") == 0)     SendTraceDump();
+    else if(strcmp(name, "blackbox_dump") == 0)  SendBlackboxDump();
+    else if(strcmp(name, "blackbox_report") == 0) SendBlackboxReport();
+    else if(strcmp(name, "blackbox_freeze") == 0) BlackboxTrigger(BLACKBOX_MANUAL);
+#ifdef STAGE_PROFILING
+    else if(strcmp(name, "prof_reset") == 0)     prof_reset_request = true;
+#endif
+    else return false;
+
+    return true;
 }
 
 /**
@@ -277,115 +4327,255 @@ void UsbCallback(uint8_t* buf, uint32_t* len)
  */
 void ProcessSerial()
 {
-    if(new_data_ready)
+    uint32_t tail = serial_tail;
+    if(tail != serial_head)
     {
-        new_data_ready = false;
+        const SerialLine& line = serial_lines[tail & (SERIAL_QUEUE_LINES - 1)];
 
         // Parse parameter name and value
         char param_name[64];
         float val;
 
         // Add width specifier to prevent buffer overflow
-        if(sscanf(serial_buf, "%63[^:]:%f", param_name, &val) == 2)
-        {
-                // Channel 1 parameters
-                if(strcmp(param_name, "ch1_gain") == 0)           ch1_gain = fclamp(val, 0.0f, 2.0f);
-                else if(strcmp(param_name, "ch1_drive") == 0)     ch1_drive = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch1_filter_freq") == 0) ch1_filter_freq = fclamp(val, 20.0f, 20000.0f);
-                else if(strcmp(param_name, "ch1_filter_res") == 0)  ch1_filter_res = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch1_delay_time") == 0)  ch1_delay_time = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch1_delay_fb") == 0)    ch1_delay_feedback = fclamp(val, 0.0f, 0.95f);
-                else if(strcmp(param_name, "ch1_delay_mix") == 0)   ch1_delay_mix = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch1_chorus_depth") == 0) ch1_chorus_depth = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch1_chorus_rate") == 0)  ch1_chorus_rate = fclamp(val, 0.01f, 10.0f);
-                else if(strcmp(param_name, "ch1_filter_mode") == 0) {
-                    int mode = (int)val;
-                    if(mode >= 0 && mode <= 2) ch1_filter_mode = (FilterMode)mode;
-                }
-
-                // Channel 2 parameters
-                else if(strcmp(param_name, "ch2_gain") == 0)           ch2_gain = fclamp(val, 0.0f, 2.0f);
-                else if(strcmp(param_name, "ch2_drive") == 0)          ch2_drive = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch2_filter_freq") == 0)    ch2_filter_freq = fclamp(val, 20.0f, 20000.0f);
-                else if(strcmp(param_name, "ch2_filter_res") == 0)     ch2_filter_res = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch2_delay_time") == 0)     ch2_delay_time = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch2_delay_fb") == 0)       ch2_delay_feedback = fclamp(val, 0.0f, 0.95f);
-                else if(strcmp(param_name, "ch2_delay_mix") == 0)      ch2_delay_mix = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch2_chorus_depth") == 0)   ch2_chorus_depth = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "ch2_chorus_rate") == 0)    ch2_chorus_rate = fclamp(val, 0.01f, 10.0f);
-                else if(strcmp(param_name, "ch2_filter_mode") == 0) {
-                    int mode = (int)val;
-                    if(mode >= 0 && mode <= 2) ch2_filter_mode = (FilterMode)mode;
-                }
+        if(sscanf(line.text, "%63[^:]:%f", param_name, &val) == 2)
+        {
+            Trace(TRACE_PARAM, ParamHash(param_name), val);
 
-                // Cross-channel and master
-                else if(strcmp(param_name, "cross_mod") == 0)      cross_mod_amt = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "cross_bleed") == 0)    cross_bleed = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "stereo_width") == 0)   stereo_width = fclamp(val, 0.0f, 2.0f);
-                else if(strcmp(param_name, "reverb_mix") == 0)     reverb_mix = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "reverb_time") == 0)    reverb_time = fclamp(val, 0.0f, 1.0f);
-                else if(strcmp(param_name, "master_gain") == 0)    master_gain = fclamp(val, 0.0f, 2.0f);
+            if(ApplyParam(param_name, val))
+                MarkStateDirty();
+            else
+                HandleCommand(param_name, val);
 
-                // Reverb parameters (disabled for now)
-                // reverb.SetFeedback(reverb_time);
-                // reverb.SetLpFreq(REVERB_LP_FREQ);
+            uint32_t latency = System::GetUs() - line.rx_us;
+            loop_stats.commands++;
+            loop_stats.latency_total += latency;
+            if(latency > loop_stats.latency_max)
+                loop_stats.latency_max = latency;
         }
+        serial_tail = tail + 1;  // Slot is free once the line is handled
+    }
+}
+
+#ifdef POLLED_MAIN_LOOP
+// Fixed-delay polling, kept to compare latency_report against: make POLLED_MAIN_LOOP=1
+constexpr uint32_t MAIN_LOOP_DELAY_MS = 1;
+
+uint32_t WaitForEvents(bool sleep)
+{
+    (void)sleep;  // The old loop delayed even with work pending
+    uint32_t t0 = System::GetUs();
+    System::Delay(MAIN_LOOP_DELAY_MS);
+    loop_stats.idle += System::GetUs() - t0;
+    return TakeEvents();
+}
+#else
+/**
+ * Sleep until an interrupt signals work, then take the pending events
+ * Interrupts are masked around the check so an event raised just before
+ * WFI is not missed: a pending interrupt still ends WFI with PRIMASK set,
+ * and its handler runs once they are unmasked.
+ */
+uint32_t WaitForEvents(bool sleep)
+{
+    __disable_irq();
+    if(sleep && main_events == 0)
+    {
+        uint32_t t0 = System::GetUs();
+        __DSB();
+        __WFI();
+        loop_stats.idle += System::GetUs() - t0;
+    }
+    uint32_t events = main_events;
+    main_events = 0;
+    __enable_irq();
+    return events;
+}
+#endif
+
+// --- MAIN LOOP TASKS ---
+uint32_t usb_init_ms = 0;
+bool usb_configured = false;
+bool led_state = true;
+
+bool TaskFootswitches()
+{
+    uint32_t pressed = __atomic_exchange_n(&fs_pressed, 0u, __ATOMIC_RELAXED);
+    for(size_t n = 0; n < NUM_FOOTSWITCHES; n++)
+        if(pressed & (1u << n))
+            FootswitchPressed(n);
+    return false;
+}
+
+// One line per slice; the rest wait for the next pass
+bool TaskSerial()
+{
+    ProcessSerial();
+    return serial_tail != serial_head;
+}
+
+// USB attach and connection state, control changes from the footswitches
+bool TaskControls()
+{
+    // Attach the receive callback once USB has had time to enumerate
+    if(usb_ready_us == 0 && System::GetNow() - usb_init_ms >= USB_ENUM_DELAY_MS)
+    {
+        hw.usb_handle.SetReceiveCallback(UsbCallback, UsbHandle::FS_INTERNAL);
+        usb_ready_us = System::GetUs();
+    }
+
+    // USB host connect/disconnect shows up as a device state change
+    bool configured = hUsbDeviceFS.dev_state == USBD_STATE_CONFIGURED;
+    if(configured != usb_configured)
+    {
+        usb_configured = configured;
+        Trace(configured ? TRACE_USB_CONNECT : TRACE_USB_DISCONNECT);
+    }
+
+    // Scene recalls and footswitch bypass toggles are saved like USB edits
+    if(control_changed)
+    {
+        control_changed = false;
+        MarkStateDirty();
     }
+    return false;
 }
 
+// Background memory clears, one chunk per slice
+bool TaskClear()
+{
+    // Delay lines reset by the stability guard are re-cleared here; a
+    // request that finds the queue full stays set and is retried next pass
+    if(fx1.del_clear_request && QueueClear(&fx1.del, sizeof(fx1.del), &fx1.del_ready))
+        fx1.del_clear_request = false;
+    if(fx2.del_clear_request && QueueClear(&fx2.del, sizeof(fx2.del), &fx2.del_ready))
+        fx2.del_clear_request = false;
+
+    bool clearing = ServiceClearJobs();
+    if(!clearing && delay_ready_us == 0)
+        delay_ready_us = System::GetUs();
+    return clearing;
+}
+
+bool TaskExpression()
+{
+    ServiceExpression();
+    return false;
+}
+
+bool TaskOnsets()
+{
+    ServiceOnsets();
+    return false;
+}
+
+bool TaskScope()
+{
+    ServiceScope();
+    return false;
+}
+
+bool TaskFeedback()
+{
+    ServiceFeedback();
+    return false;
+}
+
+// Heartbeat LED (1Hz)
+bool TaskLed()
+{
+    led_state = !led_state;
+    hw.SetLed(led_state);
+    return false;
+}
+
+/**
+ * Main loop tasks (sched_report index order, period in ms)
+ * Budgets are what a run should take; the flash stores block for a whole
+ * QSPI sector erase, which is why their budget is so much larger.
+ */
+Task main_tasks[] = {
+    // name           run                prio  events              period  budget_us
+    { "footswitch",   TaskFootswitches,  0,    EVENT_FOOTSWITCH,   0,      50 },
+    { "serial",       TaskSerial,        0,    EVENT_USB_RX,       0,      200 },
+    { "controls",     TaskControls,      1,    0,                  1,      20 },
+    { "expression",   TaskExpression,    2,    EVENT_AUDIO_BLOCK,  0,      100 },
+    { "usb_dump",     ServiceUsbDump,    3,    0,                  1,      100 },
+    { "onsets",       TaskOnsets,        4,    EVENT_AUDIO_BLOCK,  0,      50 },
+    { "scope",        TaskScope,         4,    EVENT_AUDIO_BLOCK,  0,      50 },
+    { "feedback",     TaskFeedback,      5,    EVENT_AUDIO_BLOCK,  0,      500 },
+    { "clear",        TaskClear,         6,    0,                  1,      500 },
+    { "state_store",  ServiceStateStore, 7,    0,                  10,     100000 },
+    { "scene_store",  ServiceSceneStore, 7,    0,                  10,     100000 },
+    { "led",          TaskLed,           8,    0,                  500,    20 },
+};
+
 int main(void)
 {
     // 1. Initialize Hardware
     hw.Init();
+    EnableCycleCounter();
+    block_period_cycles = (uint32_t)((float)System::GetSysClkFreq() / SAMPLE_RATE * AUDIO_BLOCK_SIZE);
 
     // 2. Configure Audio
     hw.SetAudioBlockSize(AUDIO_BLOCK_SIZE); // Low latency
     hw.SetAudioSampleRate(SaiHandle::Config::SampleRate::SAI_48KHZ);
 
-    // 3. Initialize USB Serial
-    hw.usb_handle.Init(UsbHandle::FS_INTERNAL);
-    System::Delay(100); // Allow USB to enumerate
-    hw.usb_handle.SetReceiveCallback(UsbCallback, UsbHandle::FS_INTERNAL);
-
-    // 4. Initialize Effects
+    // 3. Initialize Effects
     float sample_rate = hw.AudioSampleRate();
 
-    // Channel 1 effects
-    drive1.Init();
-    filter1.Init(sample_rate);
-    del1.Init();
-    chorus1.Init(sample_rate);
+    // Channel 1 effects (delay memory is cleared in the background)
+    fx1.drive.Init();
+    fx1.filter.Init(sample_rate);
+    fx1.mod.chorus.Init(sample_rate);
+    QueueClear(&fx1.del, sizeof(fx1.del), &fx1.del_ready);
 
     // Channel 2 effects
-    drive2.Init();
-    filter2.Init(sample_rate);
-    del2.Init();
-    chorus2.Init(sample_rate);
+    fx2.drive.Init();
+    fx2.filter.Init(sample_rate);
+    fx2.mod.chorus.Init(sample_rate);
+    QueueClear(&fx2.del, sizeof(fx2.del), &fx2.del_ready);
+
+    // Granular record buffers (SDRAM, cleared in the background like the delays)
+    InitGrainWindow();
+    QueueClear(grain_buf[0], sizeof(grain_buf[0]), &granular[0].ready);
+    QueueClear(grain_buf[1], sizeof(grain_buf[1]), &granular[1].ready);
+
+    // Vocoder and cross-synthesis routing modes, spectral freeze (SDRAM is up after hw.Init)
+    vocoder.Init(sample_rate);
+    InitFreeze();
+    InitCrossSynth();
+    InitRotary();
+    hum.Init(sample_rate);
+    InitFeedbackDetector();
 
     // Master effects (reverb disabled for compatibility)
     // reverb.Init(sample_rate);
     // reverb.SetFeedback(0.85f);
     // reverb.SetLpFreq(REVERB_LP_FREQ);
 
-    // 5. Start Audio
-    hw.StartAudio(AudioCallback);
+    // 4. Restore the last saved state before any audio is produced
+    if(LoadLastState())
+        Trace(TRACE_PRESET_LOAD, 0xFFFF);
+    LoadSceneBank();
+
+    // 5. Start Audio (delay stages stay muted until their memory is ready)
+    output_ramp.Start(0.0f, 1.0f);  // Fade in from silence
+    hw.StartAudio(routing_callbacks[routing_mode]);
+    InitFootswitches();
+    InitExpression();
+
+    // 6. Initialize USB Serial; enumeration completes while audio runs
+    hw.usb_handle.Init(UsbHandle::FS_INTERNAL);
+    usb_init_ms = System::GetNow();
 
-    // 6. Main Loop
-    bool led_state = true;
-    uint32_t last_blink = System::GetNow();
+    // 7. Main Loop
+    InitScheduler(main_tasks, sizeof(main_tasks) / sizeof(main_tasks[0]));
+    bool busy = true;
 
     while(1)
     {
-        ProcessSerial();
-        
-        // Heartbeat LED (1Hz)
-        if(System::GetNow() - last_blink > 500)
-        {
-            last_blink = System::GetNow();
-            led_state = !led_state;
-            hw.SetLed(led_state);
-        }
-
-        System::Delay(MAIN_LOOP_DELAY_MS);
+        // Sleep unless a sliced task has work left (clears, dumps, flash)
+        uint32_t events = WaitForEvents(!busy);
+        busy = RunScheduler(events);
     }
 }